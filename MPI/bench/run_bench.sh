@@ -0,0 +1,109 @@
+#!/bin/bash
+# Barnes-Hut 基準測試：產生測資，對 N × threshold × ranks × threads 的組合執行循序版與各 MPI 模式，
+# 以 --profile 收集各階段時間，計算吞吐量 (body-steps/s)，並與直接相加的參考解比較位置誤差。
+#
+#   bench/run_bench.sh [results.csv]
+#
+# 以環境變數調整測試矩陣 (以空白分隔)：
+#   DISTS       分佈 (uniform plummer galaxies clustered)
+#   SIZES       粒子數 (1000 10000)
+#   THRESHOLDS  MAC 門檻 (0.3 0.5 0.8)
+#   MODES       seq 與 --mpi_type 的值 (seq a s v o d)
+#   RANKS       MPI 行程數，seq 固定為 1 (2 4)
+#   THREADS     每個行程的執行緒數 (1)
+#   STEPS, DT   步數與時間步長 (10, 0.005)
+#   EXTRA       附加給每次執行的參數，例如 "--tree morton --force group"
+#   VARIANTS    以分號分隔的 "名稱:參數" 清單，每個組合對每個變體各跑一次，例如
+#               "mono:--force flat;quad:--force flat --quadrupole"，搭配 THRESHOLDS 即為誤差對時間的曲線
+#   MPIRUN      啟動 MPI 的指令 (mpirun)
+#   WORK        測資、輸出與執行檔的目錄 (bench_out)
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+SRC_DIR="$BENCH_DIR/../src"
+RESULTS=${1:-results.csv}
+
+DISTS=${DISTS:-"uniform plummer galaxies clustered"}
+SIZES=${SIZES:-"1000 10000"}
+THRESHOLDS=${THRESHOLDS:-"0.3 0.5 0.8"}
+MODES=${MODES:-"seq a s v o d"}
+RANKS=${RANKS:-"2 4"}
+THREADS=${THREADS:-"1"}
+STEPS=${STEPS:-10}
+DT=${DT:-0.005}
+EXTRA=${EXTRA:-""}
+VARIANTS=${VARIANTS:-"default:"}
+MPIRUN=${MPIRUN:-mpirun}
+WORK=${WORK:-bench_out}
+
+mkdir -p "$WORK"
+WORK=$(cd "$WORK" && pwd)
+BIN="$WORK/barnes_hut"
+
+# 編譯主程式與兩個輔助工具
+SRCS=$(cd "$SRC_DIR" && ls *.cpp | grep -v -e visualization.cpp -e snapshot_convert.cpp -e generate.cpp -e compare.cpp)
+(cd "$SRC_DIR" && mpic++ -O2 -march=native -o "$BIN" $SRCS -lm -pthread)
+(cd "$SRC_DIR" && c++ -O2 -o "$WORK/bh_generate" generate.cpp io.cpp snapshot.cpp)
+(cd "$SRC_DIR" && c++ -O2 -o "$WORK/bh_compare" compare.cpp io.cpp snapshot.cpp)
+
+# 把一次執行的 profile CSV (每個 rank 一列) 彙整成一列：
+# wall 與各階段時間取各 rank 的最大值，body-steps 取總和
+summarize() {
+    awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) col[$i] = i; next }
+    {
+        bs += $col["body_steps"]
+        if ($col["wall"] > wall) wall = $col["wall"]
+        if ($col["build"] > build) build = $col["build"]
+        if ($col["force"] > force) force = $col["force"]
+        if ($col["update"] > update) update = $col["update"]
+        if ($col["comm"] > comm) comm = $col["comm"]
+        if ($col["io"] > io) io = $col["io"]
+    }
+    END { printf "%.6f,%.1f,%.6f,%.6f,%.6f,%.6f,%.6f", wall, (wall > 0 ? bs / wall : 0), build, force, update, comm, io }' "$1"
+}
+
+echo "dist,bodies,mode,variant,ranks,threads,threshold,steps,wall,body_steps_per_s,build,force,update,comm,io,max_pos_err,rms_pos_err" > "$RESULTS"
+
+for dist in $DISTS; do
+    for n in $SIZES; do
+        input="$WORK/${dist}_${n}.bhs"
+        [ -f "$input" ] || "$WORK/bh_generate" "$dist" "$n" "$input" > /dev/null
+
+        # 參考解：直接相加 (--force direct)，執行緒數取 THREADS 中的最後一個
+        ref="$WORK/${dist}_${n}_ref.bhs"
+        [ -f "$ref" ] || "$BIN" -i "$input" -o "$ref" -s "$STEPS" -d "$DT" -f direct -p "${THREADS##* }" > /dev/null
+
+        for mode in $MODES; do
+            if [ "$mode" = seq ]; then ranks_list=1; else ranks_list=$RANKS; fi
+            for ranks in $ranks_list; do
+                for threads in $THREADS; do
+                    for theta in $THRESHOLDS; do
+                        IFS=';' read -ra variant_list <<< "$VARIANTS"
+                        for variant in "${variant_list[@]}"; do
+                            name=${variant%%:*}
+                            tag="${dist}_${n}_${mode}_${name}_r${ranks}_p${threads}_t${theta}"
+                            out="$WORK/$tag.bhs"
+                            prof="$WORK/$tag.csv"
+                            args=(-i "$input" -o "$out" -s "$STEPS" -d "$DT" -t "$theta" -p "$threads" --profile "$prof"
+                                  $EXTRA ${variant#*:})
+                            if [ "$mode" = seq ]; then
+                                "$BIN" "${args[@]}" > /dev/null
+                            else
+                                $MPIRUN -np "$ranks" "$BIN" "${args[@]}" -m "$mode" > /dev/null
+                            fi
+                            # 比較失敗 (粒子遺失、只在一方出界或出現非有限值) 時誤差記為 nan
+                            if cmp_out=$("$WORK/bh_compare" "$ref" "$out"); then
+                                err=$(echo "$cmp_out" | awk '{ print $4 "," $6 }')
+                            else
+                                err="nan,nan"
+                            fi
+                            row="$dist,$n,$mode,$name,$ranks,$threads,$theta,$STEPS,$(summarize "$prof"),$err"
+                            echo "$row" >> "$RESULTS"
+                            echo "$row"
+                        done
+                    done
+                done
+            done
+        done
+    done
+done
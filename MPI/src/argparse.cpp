@@ -4,8 +4,13 @@
 #include <getopt.h>
 #include <string>
 #include "common.h"
+#include "snapshot.h"
 #include <climits>  // 添加這行以定義 INT_MAX
 
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 void get_opts(int argc, char** argv, options_t* opts) {
     // 初始化預設參數
     opts->in_file = "";
@@ -17,6 +22,25 @@ void get_opts(int argc, char** argv, options_t* opts) {
     opts->visualization = false;
     opts->sequential = false;
     opts->mpi_type = ""; // 預設 MPI 類型
+    opts->tree_type = "insert";
+    opts->n_threads = 1;
+    opts->force_type = "v2";
+    opts->integrator = "euler";
+    opts->block_levels = 0;
+    opts->block_eta = 0.05;
+    opts->quadrupole = false;
+    opts->fmm_order = 4;
+    opts->domain = "fixed";
+    opts->dims = 2;
+    opts->precision = "double";
+    opts->group_size = 16;
+    opts->leaf_size = 1;
+    opts->refit_every = 0;
+    opts->exchange = "full";
+    opts->balance = false;
+    opts->checkpoint_every = 0;
+    opts->restart_file = "";
+    opts->profile_file = "";
 
     const struct option long_options[] = {
         {"input", required_argument, 0, 'i'},
@@ -28,11 +52,30 @@ void get_opts(int argc, char** argv, options_t* opts) {
         {"visualization", no_argument, 0, 'V'},
         {"sequential", no_argument, 0, 'S'},       // 改為 'S'
         {"mpi_type", required_argument, 0, 'm'},   // 添加 mpi_type
+        {"tree", required_argument, 0, 'T'},
+        {"threads", required_argument, 0, 'p'},
+        {"force", required_argument, 0, 'f'},
+        {"group-size", required_argument, 0, 'g'},
+        {"leaf-size", required_argument, 0, 'l'},
+        {"refit", required_argument, 0, 'r'},
+        {"exchange", required_argument, 0, 'x'},
+        {"balance", no_argument, 0, 'B'},
+        {"checkpoint-every", required_argument, 0, 'C'},
+        {"restart", required_argument, 0, 'R'},
+        {"profile", required_argument, 0, 'P'},
+        {"integrator", required_argument, 0, 'I'},
+        {"block-levels", required_argument, 0, 'K'},
+        {"block-eta", required_argument, 0, 'E'},
+        {"quadrupole", no_argument, 0, 'Q'},
+        {"fmm-order", required_argument, 0, 'O'},
+        {"domain", required_argument, 0, 'D'},
+        {"precision", required_argument, 0, 'F'},
+        {"dims", required_argument, 0, 'N'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "i:o:s:t:d:b:VSm:", long_options, nullptr)) != -1) { // 'n' -> 's', 's' -> 'S'
+    while ((opt = getopt_long(argc, argv, "i:o:s:t:d:b:VSm:T:p:f:g:l:r:x:BC:R:P:I:K:E:QO:D:F:N:", long_options, nullptr)) != -1) { // 'n' -> 's', 's' -> 'S'
         //DEBUG_PRINT(std::cout << "Parsing option: " << (char)opt << ", argument: " << (optarg ? optarg : "null") << std::endl); // 調試輸出
         switch (opt) {
             case 'i': opts->in_file = std::string(optarg); break;
@@ -44,6 +87,25 @@ void get_opts(int argc, char** argv, options_t* opts) {
             case 'V': opts->visualization = true; break;
             case 'S': opts->sequential = true; break;            // 更新為 'S' 對應 `sequential`
             case 'm': opts->mpi_type = std::string(optarg); break; // 設定 MPI 類型
+            case 'T': opts->tree_type = std::string(optarg); break;
+            case 'p': opts->n_threads = std::stoi(optarg); break;
+            case 'f': opts->force_type = std::string(optarg); break;
+            case 'g': opts->group_size = std::stoi(optarg); break;
+            case 'l': opts->leaf_size = std::stoi(optarg); break;
+            case 'r': opts->refit_every = std::stoi(optarg); break;
+            case 'x': opts->exchange = std::string(optarg); break;
+            case 'B': opts->balance = true; break;
+            case 'C': opts->checkpoint_every = std::stoi(optarg); break;
+            case 'R': opts->restart_file = std::string(optarg); break;
+            case 'P': opts->profile_file = std::string(optarg); break;
+            case 'I': opts->integrator = std::string(optarg); break;
+            case 'K': opts->block_levels = std::stoi(optarg); break;
+            case 'E': opts->block_eta = std::stod(optarg); break;
+            case 'Q': opts->quadrupole = true; break;
+            case 'O': opts->fmm_order = std::stoi(optarg); break;
+            case 'D': opts->domain = std::string(optarg); break;
+            case 'F': opts->precision = std::string(optarg); break;
+            case 'N': opts->dims = std::stoi(optarg); break;
             default:
                 std::cerr << "Invalid option. Use --help for usage information.\n";
                 exit(EXIT_FAILURE);
@@ -56,6 +118,125 @@ void get_opts(int argc, char** argv, options_t* opts) {
         std::cerr << "Invalid number of inputs in input file " << std::endl;
         exit(EXIT_FAILURE);
     }
+    if (opts->n_threads < 1) {
+        std::cerr << "Error: --threads must be at least 1" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->tree_type != "insert" && opts->tree_type != "morton") {
+        std::cerr << "Error: --tree must be 'insert' or 'morton'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->force_type != "v2" && opts->force_type != "flat" && opts->force_type != "group" &&
+        opts->force_type != "direct" && opts->force_type != "fmm") {
+        std::cerr << "Error: --force must be 'v2', 'flat', 'group', 'direct' or 'fmm'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // 空間分解模式只交換其他 rank 需要的節點，拿不到全部粒子
+    if (opts->force_type == "direct" && opts->mpi_type == "d") {
+        std::cerr << "Error: --force direct does not support --mpi_type d" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // 局部本質樹只含被 MAC 接受的節點質心，沒有 FMM 需要的多極矩
+    if (opts->force_type == "fmm" && opts->mpi_type == "d") {
+        std::cerr << "Error: --force fmm does not support --mpi_type d" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->fmm_order < 1 || opts->fmm_order > MAX_FMM_ORDER) {
+        std::cerr << "Error: --fmm-order must be between 1 and " << MAX_FMM_ORDER << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->domain != "fixed" && opts->domain != "adaptive") {
+        std::cerr << "Error: --domain must be 'fixed' or 'adaptive'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->precision != "double" && opts->precision != "mixed") {
+        std::cerr << "Error: --precision must be 'double' or 'mixed'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // 只有 group 模式的 SIMD 核心能從 float 得到兩倍寬度，其他走訪是逐節點的純量計算
+    if (opts->precision == "mixed" && opts->force_type != "group") {
+        std::cerr << "Error: --precision mixed requires --force group" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->dims != 2 && opts->dims != 3) {
+        std::cerr << "Error: --dims must be 2 or 3" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // 以下功能的展開式與空間填充曲線仍只有二維的實作
+    if (opts->dims == 3 && opts->force_type == "fmm") {
+        std::cerr << "Error: --dims 3 does not support --force fmm" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->dims == 3 && opts->tree_type == "morton") {
+        std::cerr << "Error: --dims 3 does not support --tree morton" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->dims == 3 && (opts->quadrupole || opts->precision == "mixed")) {
+        std::cerr << "Error: --dims 3 does not support --quadrupole or --precision mixed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // mpi_type d 以 Morton 鍵切分領域
+    if (opts->dims == 3 && opts->mpi_type == "d") {
+        std::cerr << "Error: --dims 3 does not support --mpi_type d" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->integrator != "euler" && opts->integrator != "leapfrog" && opts->integrator != "yoshida4") {
+        std::cerr << "Error: --integrator must be 'euler', 'leapfrog' or 'yoshida4'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->block_levels < 0 || opts->block_levels > MAX_BLOCK_LEVELS) {
+        std::cerr << "Error: --block-levels must be between 0 and " << MAX_BLOCK_LEVELS << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->block_levels > 0 && opts->integrator != "leapfrog") {
+        std::cerr << "Error: --block-levels requires --integrator leapfrog" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->block_eta <= 0) {
+        std::cerr << "Error: --block-eta must be positive" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // group 模式的 SIMD 清單與空間分解模式交換的虛擬粒子都只有單極項
+    if (opts->quadrupole && opts->force_type != "v2" && opts->force_type != "flat") {
+        std::cerr << "Error: --quadrupole requires --force v2 or flat" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->quadrupole && opts->mpi_type == "d") {
+        std::cerr << "Error: --quadrupole does not support --mpi_type d" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->leaf_size < 1) {
+        std::cerr << "Error: --leaf-size must be at least 1" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->refit_every < 0) {
+        std::cerr << "Error: --refit must not be negative" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->exchange != "full" && opts->exchange != "pos") {
+        std::cerr << "Error: --exchange must be 'full' or 'pos'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->group_size < 1) {
+        std::cerr << "Error: --group-size must be at least 1" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (!opts->profile_file.empty() && !endsWith(opts->profile_file, ".json") && !endsWith(opts->profile_file, ".csv")) {
+        std::cerr << "Error: --profile must end in .json or .csv" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (opts->checkpoint_every < 0) {
+        std::cerr << "Error: --checkpoint-every must not be negative" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // 從檢查點繼續時以檢查點取代輸入檔
+    if (!opts->restart_file.empty()) {
+        if (!isSnapshotPath(opts->restart_file)) {
+            std::cerr << "Error: --restart expects a " << SNAPSHOT_EXTENSION << " checkpoint" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        opts->in_file = opts->restart_file;
+    }
     if (opts->in_file.empty()) {
         std::cerr << "Error: Input file not specified!" << std::endl;
         exit(EXIT_FAILURE);
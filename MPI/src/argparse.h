@@ -15,6 +15,25 @@ struct options_t {
     bool visualization;     // 可視化標誌
     bool sequential;        // 是否使用序列模式
     std::string mpi_type;   
+    std::string tree_type;  // 建樹方式："insert" (逐一插入) 或 "morton" (Z 曲線排序)
+    int n_threads;          // 每個行程計算力與更新狀態的執行緒數
+    std::string force_type; // 力計算方式："v2" (遞迴走訪節點池)、"flat" (攤平 SoA 迭代走訪)、"group" (群組共用清單 + SIMD)、"direct" (直接相加 O(N²)) 或 "fmm" (快速多極法)
+    int group_size;         // group 模式每個群組的最大粒子數
+    int leaf_size;          // 葉節點最多容納的粒子數
+    std::string exchange;   // mpi_type v 每步交換的內容："full" (整個粒子) 或 "pos" (位置與質量)
+    bool balance;           // mpi_type v / d 依交互作用次數動態重新分配粒子
+    int refit_every;        // >0 時沿用上一步的樹只重算質心，每 refit_every 步完整重建一次
+    int checkpoint_every;   // >0 時每 checkpoint_every 步在背景寫一次檢查點
+    std::string restart_file; // 非空時從此檢查點繼續，取代 in_file
+    std::string profile_file; // 非空時把各 rank 的階段時間與計數器寫到此檔 (.json 或 .csv)
+    std::string integrator; // 時間積分："euler" (原本的更新)、"leapfrog" (KDK) 或 "yoshida4" (四階辛積分)
+    int block_levels;       // >0 時使用 block_levels 層 2 的冪次區塊時間步 (dt, dt/2, ...)
+    double block_eta;       // 區塊時間步的精度參數，粒子步長不超過 block_eta * sqrt(RLIMIT / |a|)
+    bool quadrupole;        // 節點加上四極矩，被接受的節點以質心展開到二階
+    int fmm_order;          // fmm 模式多極與局部展開的階數
+    std::string precision;  // group 模式的精度："double" 或 "mixed" (節點與相對位置為 float，以 double 累加)
+    int dims;               // 空間維度：2 (四叉樹) 或 3 (八叉樹)
+    std::string domain;     // 根節點範圍："fixed" (固定的 [MIN_X, MAX_X] x [MIN_Y, MAX_Y]) 或 "adaptive" (每步取粒子的外接正方形)
 };
 
 // 解析命令行參數
@@ -0,0 +1,64 @@
+#include "balance.h"
+#include <cstdio>
+#include "common.h"
+#include <mpi.h>
+
+void partitionByCost(const int* cost, int n, int num_procs, std::vector<int>* counts, std::vector<int>* displs) {
+    double total = 0.0;
+    for (int i = 0; i < n; i++) {
+        total += cost[i] + 1.0;
+    }
+
+    counts->assign(num_procs, 0);
+    displs->assign(num_procs, 0);
+    double acc = 0.0;
+    int r = 0;
+    for (int i = 0; i < n; i++) {
+        // 累積權重超過第 r 段的上限就換下一段
+        while (r < num_procs - 1 && acc >= total * (r + 1) / num_procs) {
+            r++;
+            (*displs)[r] = i;
+        }
+        (*counts)[r]++;
+        acc += cost[i] + 1.0;
+    }
+    for (r = r + 1; r < num_procs; r++) {
+        (*displs)[r] = n;
+    }
+}
+
+double costImbalance(const int* cost, const std::vector<int>& counts, const std::vector<int>& displs) {
+    int num_procs = (int)counts.size();
+    double total = 0.0, heaviest = 0.0;
+    for (int r = 0; r < num_procs; r++) {
+        double w = 0.0;
+        for (int i = displs[r]; i < displs[r] + counts[r]; i++) {
+            w += cost[i] + 1.0;
+        }
+        total += w;
+        heaviest = w > heaviest ? w : heaviest;
+    }
+    return total > 0.0 ? heaviest * num_procs / total : 1.0;
+}
+
+void reportImbalance(const options_t* opts, double compute_time, long long interactions, int rank, int num_procs) {
+    if (!opts->balance && !TIMING_TEST) return;
+
+    std::vector<double> times(num_procs);
+    std::vector<long long> work(num_procs);
+    MPI_Gather(&compute_time, 1, MPI_DOUBLE, times.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather(&interactions, 1, MPI_LONG_LONG, work.data(), 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    double t_sum = 0.0, t_max = 0.0, w_sum = 0.0, w_max = 0.0;
+    for (int r = 0; r < num_procs; r++) {
+        printf("rank %d: force %f s, %lld interactions\n", r, times[r], work[r]);
+        t_sum += times[r];
+        t_max = times[r] > t_max ? times[r] : t_max;
+        w_sum += (double)work[r];
+        w_max = work[r] > w_max ? (double)work[r] : w_max;
+    }
+    printf("imbalance (max/avg): time %f, interactions %f\n",
+           t_sum > 0 ? t_max * num_procs / t_sum : 1.0,
+           w_sum > 0 ? w_max * num_procs / w_sum : 1.0);
+}
@@ -0,0 +1,18 @@
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#include <vector>
+#include "particle.h"
+#include "argparse.h"
+
+constexpr double REBALANCE_TOLERANCE = 1.05;    // 預估最重 / 平均超過此值才重新分割
+
+// 以上一步的交互作用次數 (cost + 1) 為權重，把連續的 n 個粒子切成 num_procs 段
+void partitionByCost(const int* cost, int n, int num_procs, std::vector<int>* counts, std::vector<int>* displs);
+// 目前分割下最重一段與平均的比值
+double costImbalance(const int* cost, const std::vector<int>& counts, const std::vector<int>& displs);
+// 在 rank 0 印出每個 rank 的力計算時間與交互作用次數，以及最大 / 平均的比值；
+// 只在 --balance 或以 -DTIMING 編譯時輸出，其餘情況 stdout 仍只有執行時間
+void reportImbalance(const options_t* opts, double compute_time, long long interactions, int rank, int num_procs);
+
+#endif // BALANCE_H
@@ -0,0 +1,172 @@
+#include "block_step.h"
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "common.h"
+#include "domain.h"
+#include "tree.h"
+
+template <int D>
+int blockLevel(const options_t* opts, const BodyHotT<D>* body, const BodyColdT<D>* cold) {
+    double a2 = cold->a_x * cold->a_x + cold->a_y * cold->a_y;
+    if constexpr (D == 3) {
+        a2 += cold->a_z * cold->a_z;
+    }
+    double a = std::sqrt(a2);
+    if (body->mass == OUT_OF_BOUNDS_MASS || a == 0.0) {
+        return 0;
+    }
+    double dt_body = opts->block_eta * std::sqrt(RLIMIT / a);
+    int level = 0;
+    while (level < opts->block_levels - 1 && opts->timestep / (1 << level) > dt_body) {
+        level++;
+    }
+    return level;
+}
+
+template <int D>
+void runBlockTimesteps(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool, BodiesT<D>* bodies, int n,
+                       std::vector<int32_t>* slot, CheckpointWriterT<D>* checkpoint, RunProfile* profile) {
+    const int ticks = 1 << (opts->block_levels - 1);   // 每個基本步的最小子步數
+    const double dt_min = opts->timestep / ticks;
+    std::vector<int> level(n);
+    std::vector<uint8_t> active(n, 1);
+    std::vector<vec_t<D>> forces(n);
+    std::vector<long long> histogram(opts->block_levels, 0);
+    std::vector<int> slot_level(n);         // 依輸入順序暫存層級，搬動粒子時用
+    std::vector<particle_t<D>> ordered(n);
+    int n_live = compactBodies(bodies, n, slot);
+
+    // 子步之間靠 refit 更新樹，由這裡決定何時重建，不使用 --refit
+    options_t step_opts = *opts;
+    step_opts.refit_every = 0;
+
+    // 第一個 kick 需要初始位置的加速度；從檢查點繼續時加速度已存在檢查點中，只需建樹取得邊界
+    int first = restartStep(opts);
+    {
+        PhaseTimer timer(profile, PHASE_BUILD);
+        buildForceTree(&step_opts, engine, pool, bodies, n_live, 0);
+    }
+    if (first == 0) {
+        PhaseTimer timer(profile, PHASE_FORCE);
+        computeForces(&step_opts, engine, pool, 0, n_live, forces.data());
+    }
+    for (int i = 0; i < n_live; i++) {
+        level[i] = blockLevel(opts, &bodies->hot[i], &bodies->cold[i]);
+    }
+
+    for (int s = first; s < opts->n_steps; s++) {
+        for (int t = 0; t < ticks; t++) {
+            // 步長從 t 開始的粒子先做前半個 kick，再讓所有粒子 drift 一個最小子步
+            {
+                PhaseTimer timer(profile, PHASE_UPDATE);
+                const NodeT<D>* root = tree_root(&engine->tree);
+                pool->parallel_for(n_live, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                    for (int i = begin; i < end; i++) {
+                        BodyHotT<D>* b = &bodies->hot[i];
+                        BodyColdT<D>* c = &bodies->cold[i];
+                        if (b->mass == OUT_OF_BOUNDS_MASS) continue;   // 停在離開時的狀態
+                        int stride = ticks >> level[i];
+                        if (t % stride == 0) {
+                            double half = 0.5 * stride * dt_min;
+                            for (int k = 0; k < D; k++) {
+                                c->vel(k) += c->acc(k) * half;
+                            }
+                        }
+                        for (int k = 0; k < D; k++) {
+                            b->pos(k) += c->vel(k) * dt_min;
+                        }
+                        if (opts->domain == "fixed" && !contains(root, b)) {
+                            b->mass = OUT_OF_BOUNDS_MASS;
+                        }
+                    }
+                });
+            }
+
+            {
+                PhaseTimer timer(profile, PHASE_BUILD);
+                if (t == 0) {
+                    buildForceTree(&step_opts, engine, pool, bodies, n_live, 0);
+                } else {
+                    refitForceTree(&step_opts, engine, pool, n_live);
+                }
+            }
+            profileTree(opts, profile, &engine->tree);
+
+            // 只有步長在 t + 1 結束的粒子需要新的力
+            int n_active = 0;
+            for (int i = 0; i < n_live; i++) {
+                active[i] = (t + 1) % (ticks >> level[i]) == 0;
+                n_active += active[i];
+            }
+            {
+                PhaseTimer timer(profile, PHASE_FORCE);
+                computeForces(&step_opts, engine, pool, 0, n_live, forces.data(), active.data());
+            }
+            for (int i = 0; i < n_live; i++) {
+                const BodyColdT<D>* c = &bodies->cold[i];
+                if (!active[i] || c->index == -10) continue;
+                profile->interactions += c->cost;
+                profile->max_visits = c->cost > profile->max_visits ? c->cost : profile->max_visits;
+                profile->body_steps++;
+                histogram[level[i]]++;
+            }
+            profile->steps++;
+
+            // 後半個 kick，並重新選擇層級：變細隨時可以，變粗則要等新步長的邊界對齊
+            {
+                PhaseTimer timer(profile, PHASE_UPDATE);
+                pool->parallel_for(n_live, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                    for (int i = begin; i < end; i++) {
+                        const BodyHotT<D>* b = &bodies->hot[i];
+                        BodyColdT<D>* c = &bodies->cold[i];
+                        if (!active[i] || b->mass == OUT_OF_BOUNDS_MASS) continue;
+                        double half = 0.5 * (ticks >> level[i]) * dt_min;
+                        for (int k = 0; k < D; k++) {
+                            c->vel(k) += c->acc(k) * half;
+                        }
+                        int next = blockLevel(opts, b, c);
+                        while (next < level[i] && (t + 1) % (ticks >> next) != 0) {
+                            next++;
+                        }
+                        level[i] = next;
+                    }
+                });
+            }
+        }
+        releaseForceTree(&step_opts, engine);
+
+        // 移走這一步超出邊界的粒子，層級跟著粒子搬動
+        for (int i = 0; i < n_live; i++) {
+            slot_level[(*slot)[i]] = level[i];
+        }
+        int live = compactBodies(bodies, n_live, slot);
+        if (live != n_live) {
+            n_live = live;
+            for (int i = 0; i < n_live; i++) {
+                level[i] = slot_level[(*slot)[i]];
+            }
+        }
+
+        if (checkpointDue(opts, s + 1)) {
+            PhaseTimer timer(profile, PHASE_IO);
+            restoreOrder(*bodies, n, *slot, ordered.data());
+            checkpoint->write(ordered.data(), n, s + 1);
+        }
+    }
+
+    TIMING_PRINT(printf("Block timesteps: %lld force evaluations (%.2f per body and step)\n", profile->body_steps,
+                        (double)profile->body_steps / ((double)n * (opts->n_steps - first))));
+    for (int l = 0; l < opts->block_levels; l++) {
+        TIMING_PRINT(printf("  level %d (dt / %d): %lld\n", l, 1 << l, histogram[l]));
+    }
+}
+
+template int blockLevel<2>(const options_t*, const BodyHot*, const BodyCold*);
+template int blockLevel<3>(const options_t*, const BodyHotT<3>*, const BodyColdT<3>*);
+template void runBlockTimesteps<2>(const options_t*, ForceEngine*, ThreadPool*, Bodies*, int, std::vector<int32_t>*,
+                                   CheckpointWriter*, RunProfile*);
+template void runBlockTimesteps<3>(const options_t*, ForceEngineT<3>*, ThreadPool*, BodiesT<3>*, int,
+                                   std::vector<int32_t>*, CheckpointWriterT<3>*, RunProfile*);
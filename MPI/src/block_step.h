@@ -0,0 +1,25 @@
+#ifndef BLOCK_STEP_H
+#define BLOCK_STEP_H
+
+#include <cstdint>
+#include <vector>
+#include "argparse.h"
+#include "checkpoint.h"
+#include "force.h"
+#include "bodies.h"
+#include "profile.h"
+#include "thread_pool.h"
+
+// 階層式區塊時間步 (--block-levels K)：粒子 i 的步長為 dt / 2^L，L 介於 0 與 K - 1，
+// 由加速度決定 (步長不超過 --block-eta * sqrt(RLIMIT / |a|))。每個基本步 dt 分成 2^(K-1) 個最小子步，
+// 每個子步所有粒子一起 drift，只有步長在此結束的粒子計算力並做 KDK 的 kick。
+// 每個基本步開頭完整建樹，其餘子步只 refit。基本步的邊界上所有粒子同步，檢查點只寫在這裡，
+// 超出邊界的粒子也在這裡移到陣列尾端 (見 compactBodies)。
+template <int D>
+int blockLevel(const options_t* opts, const BodyHotT<D>* body, const BodyColdT<D>* cold);
+// 從檢查點 (或第 0 步) 跑到 opts->n_steps，必要時依 slot 排回輸入順序寫檢查點
+template <int D>
+void runBlockTimesteps(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool, BodiesT<D>* bodies, int n,
+                       std::vector<int32_t>* slot, CheckpointWriterT<D>* checkpoint, RunProfile* profile);
+
+#endif // BLOCK_STEP_H
@@ -0,0 +1,52 @@
+#include "bodies.h"
+
+template <int D>
+void splitBodies(const particle_t<D>* p, int n, BodiesT<D>* bodies) {
+    bodies->resize(n);
+    for (int i = 0; i < n; i++) {
+        BodyHotT<D>* h = &bodies->hot[i];
+        BodyColdT<D>* c = &bodies->cold[i];
+        h->x = p[i].x;
+        h->y = p[i].y;
+        h->mass = p[i].mass;
+        c->v_x = p[i].v_x;
+        c->v_y = p[i].v_y;
+        c->a_x = p[i].a_x;
+        c->a_y = p[i].a_y;
+        if constexpr (D == 3) {
+            h->z = p[i].z;
+            c->v_z = p[i].v_z;
+            c->a_z = p[i].a_z;
+        }
+        c->index = p[i].index;
+        c->cost = p[i].cost;
+    }
+}
+
+template <int D>
+void joinBodies(const BodiesT<D>& bodies, int lo, int n, particle_t<D>* out) {
+    for (int i = 0; i < n; i++) {
+        const BodyHotT<D>* h = &bodies.hot[lo + i];
+        const BodyColdT<D>* c = &bodies.cold[lo + i];
+        particle_t<D>* p = &out[i];
+        p->index = c->index;
+        p->cost = c->cost;
+        p->x = h->x;
+        p->y = h->y;
+        p->mass = h->mass;
+        p->v_x = c->v_x;
+        p->v_y = c->v_y;
+        p->a_x = c->a_x;
+        p->a_y = c->a_y;
+        if constexpr (D == 3) {
+            p->z = h->z;
+            p->v_z = c->v_z;
+            p->a_z = c->a_z;
+        }
+    }
+}
+
+template void splitBodies<2>(const particle* p, int n, Bodies* bodies);
+template void splitBodies<3>(const particle3* p, int n, BodiesT<3>* bodies);
+template void joinBodies<2>(const Bodies& bodies, int lo, int n, particle* out);
+template void joinBodies<3>(const BodiesT<3>& bodies, int lo, int n, particle3* out);
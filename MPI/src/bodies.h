@@ -0,0 +1,101 @@
+#ifndef BODIES_H
+#define BODIES_H
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "particle.h"
+
+// 模擬期間的粒子資料，依存取頻率拆成兩個陣列 (hot / cold split)：
+// 建樹與力計算每走訪一次就要讀的位置與質量放在 hot，一個粒子 24 bytes (三維 32 bytes)；
+// 只有積分器、負載平衡與 I/O 才碰的速度、加速度、index 與 cost 放在 cold。
+// 同一個粒子在兩個陣列中的位置相同。particle 只作為檔案與檢查點的格式，
+// 兩者之間只在讀寫時轉換 (splitBodies / joinBodies)。
+//
+// 兩種結構都以維度 D (2 或 3) 特化，成員沿用 x / y / z 的名稱；
+// 維度泛型的程式以 pos(d)、vel(d)、acc(d) 取第 d 軸，d 為常數時與直接取成員相同。
+
+template <int D> struct BodyHotT;
+template <int D> struct BodyColdT;
+
+template <>
+struct BodyHotT<2> {
+    double x, y;
+    double mass;
+
+    double& pos(int d) { return d == 0 ? x : y; }
+    double pos(int d) const { return d == 0 ? x : y; }
+};
+static_assert(sizeof(BodyHotT<2>) == 3 * sizeof(double), "BodyHot is exchanged as 3 contiguous doubles");
+
+template <>
+struct BodyHotT<3> {
+    double x, y, z;
+    double mass;
+
+    double& pos(int d) { return d == 0 ? x : (d == 1 ? y : z); }
+    double pos(int d) const { return d == 0 ? x : (d == 1 ? y : z); }
+};
+
+template <>
+struct BodyColdT<2> {
+    double v_x, v_y;
+    double a_x = 0.0, a_y = 0.0;
+    int index;
+    int cost = 0;                 // 上一步力計算的交互作用次數，用於負載平衡
+
+    double& vel(int d) { return d == 0 ? v_x : v_y; }
+    double& acc(int d) { return d == 0 ? a_x : a_y; }
+    double acc(int d) const { return d == 0 ? a_x : a_y; }
+};
+
+template <>
+struct BodyColdT<3> {
+    double v_x, v_y, v_z;
+    double a_x = 0.0, a_y = 0.0, a_z = 0.0;
+    int index;
+    int cost = 0;
+
+    double& vel(int d) { return d == 0 ? v_x : (d == 1 ? v_y : v_z); }
+    double& acc(int d) { return d == 0 ? a_x : (d == 1 ? a_y : a_z); }
+    double acc(int d) const { return d == 0 ? a_x : (d == 1 ? a_y : a_z); }
+};
+
+template <int D>
+struct BodiesT {
+    std::vector<BodyHotT<D>> hot;
+    std::vector<BodyColdT<D>> cold;
+
+    int size() const { return (int)hot.size(); }
+    void resize(int n) {
+        hot.resize(n);
+        cold.resize(n);
+    }
+};
+
+// 二維 (原本的四叉樹) 所用的名稱
+using BodyHot = BodyHotT<2>;
+using BodyCold = BodyColdT<2>;
+using Bodies = BodiesT<2>;
+
+// D 維的力或加速度。長度寫成 size_t(D)，呼叫時樣板參數 D 只由其他參數 (樹、粒子) 推導
+template <int D> using vec_t = std::array<double, size_t(D)>;
+
+// 向量長度的平方；二維時即原本的 v[0] * v[0] + v[1] * v[1]，計算順序不變
+template <int D>
+inline double norm2(const double* v) {
+    double r = v[0] * v[0] + v[1] * v[1];
+    if constexpr (D == 3) {
+        r += v[2] * v[2];
+    }
+    return r;
+}
+
+// 把 p[0, n) 轉成 bodies (取代原有內容)
+template <int D>
+void splitBodies(const particle_t<D>* p, int n, BodiesT<D>* bodies);
+// 把 bodies 的 [lo, lo + n) 轉回 particle，寫到 out[0, n)
+template <int D>
+void joinBodies(const BodiesT<D>& bodies, int lo, int n, particle_t<D>* out);
+
+#endif // BODIES_H
@@ -0,0 +1,83 @@
+#include "checkpoint.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include "snapshot.h"
+#include <unistd.h>
+
+template <int D>
+CheckpointWriterT<D>::CheckpointWriterT(const std::string& path) : path(path) {}
+
+template <int D>
+CheckpointWriterT<D>::~CheckpointWriterT() {
+    wait();
+}
+
+template <int D>
+bool CheckpointWriterT<D>::wait() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+    if (failed_step < 0) {
+        return true;
+    }
+    std::cerr << "Error: Unable to write checkpoint " << path << " at step " << failed_step
+              << "; the previous checkpoint is kept" << std::endl;
+    failed_step = -1;
+    return false;
+}
+
+template <int D>
+void CheckpointWriterT<D>::write(const particle_t<D>* bodies, int n, int step) {
+    wait();
+    buffer.assign(bodies, bodies + n);
+    start(n, step);
+}
+
+template <int D>
+void CheckpointWriterT<D>::write(const BodiesT<D>& bodies, int n, int step) {
+    wait();
+    buffer.resize(n);
+    joinBodies(bodies, 0, n, buffer.data());
+    start(n, step);
+}
+
+template <int D>
+void CheckpointWriterT<D>::start(int n, int step) {
+    // 背景執行緒不印訊息也不結束程式，只記錄失敗，由下一次 wait() 回報。
+    // 暫存檔沒有完整寫到磁碟就不 rename，上一個檢查點不會被截斷的檔案取代
+    worker = std::thread([this, n, step]() {
+        std::string tmp = path + ".tmp";
+        bool ok = writeSnapshot(tmp, buffer.data(), n, step, SNAPSHOT_ACCEL, true) &&
+                  rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok) {
+            unlink(tmp.c_str());
+            failed_step = step;
+        }
+    });
+}
+
+template class CheckpointWriterT<2>;
+template class CheckpointWriterT<3>;
+
+std::string checkpointPath(const options_t* opts) {
+    return opts->out_file + ".checkpoint" + SNAPSHOT_EXTENSION;
+}
+
+bool checkpointDue(const options_t* opts, int step) {
+    return opts->checkpoint_every > 0 && step > 0 && step % opts->checkpoint_every == 0 && step < opts->n_steps;
+}
+
+int restartStep(const options_t* opts) {
+    if (opts->restart_file.empty()) {
+        return 0;
+    }
+    SnapshotHeader header;
+    readSnapshotHeader(opts->restart_file, &header);
+    if (header.step > (uint64_t)opts->n_steps) {
+        std::cerr << "Error: " << opts->restart_file << " is at step " << header.step
+                  << ", beyond --steps " << opts->n_steps << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return (int)header.step;
+}
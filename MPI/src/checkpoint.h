@@ -0,0 +1,47 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <thread>
+#include <vector>
+#include "argparse.h"
+#include "bodies.h"
+#include "particle.h"
+
+// 週期性檢查點：在背景執行緒把粒子狀態 (含加速度與已完成步數) 寫成 .bhs 快照，
+// 時間步迴圈只需付出一次記憶體複製。寫到暫存檔後再 rename，當機時不會留下寫一半的檔案。
+// D 為 3 時寫出三維快照。
+template <int D>
+class CheckpointWriterT {
+public:
+    explicit CheckpointWriterT(const std::string& path);
+    ~CheckpointWriterT();
+
+    // 複製 bodies 後交給背景執行緒寫出；上一個檢查點尚未寫完時先等它完成
+    void write(const particle_t<D>* bodies, int n, int step);
+    // 同上，把 bodies 的前 n 個粒子轉成 particle 後寫出
+    void write(const BodiesT<D>& bodies, int n, int step);
+    // 等背景執行緒寫完；上一個檢查點寫入失敗時在此 (主執行緒) 印出錯誤並回傳 false，
+    // 先前成功的檢查點保持不變，模擬照常進行
+    bool wait();
+
+private:
+    // 以背景執行緒把 buffer 寫到 path
+    void start(int n, int step);
+
+    std::string path;
+    std::vector<particle_t<D>> buffer;
+    std::thread worker;
+    int failed_step = -1;       // 背景執行緒寫入失敗的步數，-1 表示沒有失敗
+};
+
+using CheckpointWriter = CheckpointWriterT<2>;
+
+// 檢查點檔名：<輸出檔>.checkpoint.bhs
+std::string checkpointPath(const options_t* opts);
+// 完成 step 步後是否要寫檢查點 (step 為 0 或最後一步時不寫，最後一步直接寫輸出檔)
+bool checkpointDue(const options_t* opts, int step);
+// --restart 時回傳檢查點記錄的已完成步數，否則回傳 0
+int restartStep(const options_t* opts);
+
+#endif // CHECKPOINT_H
@@ -24,6 +24,8 @@ constexpr double MIN_Y = 0.0;               // 領域最小 Y 值
 constexpr double MAX_Y = 4.0;               // 領域最大 Y 值
 constexpr double G = 0.0001;                // 引力常數
 constexpr double RLIMIT = 0.03;             // 最小距離限制，避免除以零
+constexpr int MAX_BLOCK_LEVELS = 16;        // 區塊時間步最多的層數 (最小步長 dt / 2^15)
+constexpr int MAX_FMM_ORDER = 16;           // FMM 展開階數的上限
 
 const static double MS_PER_S = 1000.0f; // 毫秒與秒之間的轉換
 const static double NS_PER_MS = 1000.0f; // 納秒與毫秒之間的轉換
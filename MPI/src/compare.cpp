@@ -0,0 +1,98 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "io.h"
+
+// 以粒子 index 對應，比較兩個輸出檔的位置與速度誤差 (文字或 .bhs 皆可)：
+//   ./bh_compare reference.bhs result.bhs
+// 輸出一行：compared <n> max_pos <e> rms_pos <e> max_vel <e> rms_vel <e>
+// 兩方皆已超出邊界 (質量為 OUT_OF_BOUNDS_MASS) 的粒子不列入比較；只有一方出界、
+// 位置或速度不是有限值，或沒有任何粒子可比較時，印出錯誤並以非零值結束。
+static std::vector<const particle*> byIndex(const particle* bodies, int n) {
+    std::vector<const particle*> map;
+    for (int i = 0; i < n; i++) {
+        int k = bodies[i].index;
+        if (k < 0) continue;
+        if (k >= (int)map.size()) map.resize(k + 1, nullptr);
+        map[k] = &bodies[i];
+    }
+    return map;
+}
+
+static bool isFinite(const particle* p) {
+    return std::isfinite(p->x) && std::isfinite(p->y) && std::isfinite(p->v_x) && std::isfinite(p->v_y);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <reference> <result>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    options_t opts;
+    int n_ref = 0, n_res = 0;
+    particle* ref = nullptr;
+    particle* res = nullptr;
+    opts.in_file = argv[1];
+    read_file(&opts, &n_ref, &ref);
+    opts.in_file = argv[2];
+    read_file(&opts, &n_res, &res);
+
+    std::vector<const particle*> ref_map = byIndex(ref, n_ref);
+    std::vector<const particle*> res_map = byIndex(res, n_res);
+
+    int compared = 0, missing = 0, left = 0, nonfinite = 0;
+    double max_pos = 0, sum_pos = 0, max_vel = 0, sum_vel = 0;
+    for (size_t k = 0; k < ref_map.size(); k++) {
+        const particle* a = ref_map[k];
+        if (!a) continue;
+        const particle* b = k < res_map.size() ? res_map[k] : nullptr;
+        if (!b) {
+            missing++;
+            continue;
+        }
+        bool a_out = a->mass == OUT_OF_BOUNDS_MASS;
+        bool b_out = b->mass == OUT_OF_BOUNDS_MASS;
+        if (a_out && b_out) continue;
+        if (a_out != b_out) {
+            left++;
+            continue;
+        }
+        if (!isFinite(a) || !isFinite(b)) {
+            nonfinite++;
+            continue;
+        }
+        double dp = std::hypot(a->x - b->x, a->y - b->y);
+        double dv = std::hypot(a->v_x - b->v_x, a->v_y - b->v_y);
+        max_pos = std::max(max_pos, dp);
+        max_vel = std::max(max_vel, dv);
+        sum_pos += dp * dp;
+        sum_vel += dv * dv;
+        compared++;
+    }
+    if (missing > 0) {
+        std::cerr << "Error: " << missing << " bodies of " << argv[1] << " are missing from " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (left > 0) {
+        std::cerr << "Error: " << left << " bodies left the domain in only one of " << argv[1] << " and " << argv[2]
+                  << std::endl;
+    }
+    if (nonfinite > 0) {
+        std::cerr << "Error: " << nonfinite << " bodies have non-finite positions or velocities" << std::endl;
+    }
+    if (compared == 0) {
+        std::cerr << "Error: no bodies to compare" << std::endl;
+    }
+    if (left > 0 || nonfinite > 0 || compared == 0) {
+        return EXIT_FAILURE;
+    }
+
+    printf("compared %d max_pos %.6e rms_pos %.6e max_vel %.6e rms_vel %.6e\n", compared, max_pos,
+           std::sqrt(sum_pos / compared), max_vel, std::sqrt(sum_vel / compared));
+    free(ref);
+    free(res);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+#include "direct_force.h"
+#include "common.h"
+#include "group_force.h"
+
+template <int D>
+void gatherDirectSources(const NodeT<D>* root, const BodyHotT<D>* bodies, int n, DirectSources* src) {
+    src->x.resize(n + SIMD_PAD);
+    src->y.resize(n + SIMD_PAD);
+    if (D == 3) src->z.resize(n + SIMD_PAD);
+    src->gm.resize(n + SIMD_PAD);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        const BodyHotT<D>* b = &bodies[i];
+        if (b->mass == OUT_OF_BOUNDS_MASS || !contains(root, b)) continue;
+        src->x[k] = b->x;
+        src->y[k] = b->y;
+        if constexpr (D == 3) {
+            src->z[k] = b->z;
+        }
+        src->gm[k] = G * b->mass;
+        k++;
+    }
+    src->n = k;
+    src->padded = (k + SIMD_PAD - 1) / SIMD_PAD * SIMD_PAD;
+    for (int j = k; j < src->padded; j++) {
+        src->x[j] = src->y[j] = 0.0;
+        if (D == 3) src->z[j] = 0.0;
+        src->gm[j] = 0.0;
+    }
+}
+
+// 目標粒子分成 DIRECT_TARGET_BLOCK 個一批，由執行緒池分配；
+// 每批依序走過來源的各塊，同一塊來源在 L1 內被整批目標重複使用
+template <int D>
+void computeForcesDirect(const DirectSources* src, ThreadPool* pool, BodiesT<D>* bodies,
+                         int lo, int hi, vec_t<D>* forces, const uint8_t* active) {
+    const double* sx = src->x.data();
+    const double* sy = src->y.data();
+    const double* sz = src->z.data();
+    const double* gm = src->gm.data();
+    const BodyHotT<D>* hot = bodies->hot.data();
+    int n_blocks = (hi - lo + DIRECT_TARGET_BLOCK - 1) / DIRECT_TARGET_BLOCK;
+
+    pool->parallel_for(n_blocks, 1, [&](int begin, int end, int) {
+        double acc[D][DIRECT_TARGET_BLOCK];
+        for (int blk = begin; blk < end; blk++) {
+            int b0 = lo + blk * DIRECT_TARGET_BLOCK;
+            int count = hi - b0 < DIRECT_TARGET_BLOCK ? hi - b0 : DIRECT_TARGET_BLOCK;
+            for (int i = 0; i < count; i++) {
+                for (int k = 0; k < D; k++) {
+                    acc[k][i] = 0.0;
+                }
+            }
+
+            for (int t = 0; t < src->padded; t += DIRECT_SOURCE_TILE) {
+                int len = src->padded - t < DIRECT_SOURCE_TILE ? src->padded - t : DIRECT_SOURCE_TILE;
+                for (int i = 0; i < count; i++) {
+                    const BodyHotT<D>* body = &hot[b0 + i];
+                    if (body->mass == OUT_OF_BOUNDS_MASS || (active && !active[b0 + i])) continue;
+                    double a[D];
+                    if constexpr (D == 3) {
+                        accumulateInteractions(sx + t, sy + t, sz + t, gm + t, len, body->x, body->y, body->z,
+                                               &a[0], &a[1], &a[2]);
+                    } else {
+                        accumulateInteractions(sx + t, sy + t, gm + t, len, body->x, body->y, &a[0], &a[1]);
+                    }
+                    for (int k = 0; k < D; k++) {
+                        acc[k][i] += a[k];
+                    }
+                }
+            }
+
+            for (int i = 0; i < count; i++) {
+                const BodyHotT<D>* body = &hot[b0 + i];
+                if (active && !active[b0 + i]) continue;
+                if (body->mass == OUT_OF_BOUNDS_MASS) {
+                    forces[b0 + i - lo] = {};
+                    continue;
+                }
+                BodyColdT<D>* cold = &bodies->cold[b0 + i];
+                cold->cost = src->n;
+                for (int k = 0; k < D; k++) {
+                    cold->acc(k) = acc[k][i];
+                    forces[b0 + i - lo][k] = acc[k][i] * body->mass;
+                }
+            }
+        }
+    });
+}
+
+#define INSTANTIATE_DIRECT(D)                                                                         \
+    template void gatherDirectSources<D>(const NodeT<D>*, const BodyHotT<D>*, int, DirectSources*);   \
+    template void computeForcesDirect<D>(const DirectSources*, ThreadPool*, BodiesT<D>*, int, int,   \
+                                         vec_t<D>*, const uint8_t*);
+
+INSTANTIATE_DIRECT(2)
+INSTANTIATE_DIRECT(3)
@@ -0,0 +1,30 @@
+#ifndef DIRECT_FORCE_H
+#define DIRECT_FORCE_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "bodies.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+constexpr int DIRECT_SOURCE_TILE = 512;  // 每塊來源 12 KB (x, y, gm；三維 16 KB)，留在 L1 給整批目標粒子重複使用
+constexpr int DIRECT_TARGET_BLOCK = 64;  // 每個工作項目處理的目標粒子數
+
+// 直接相加 (O(N²)) 的來源粒子 (SoA)，長度補齊到 SIMD 寬度的倍數。
+// gm 直接存 G * mass，補齊的項目 gm = 0。只收根節點內的粒子，與樹的插入條件相同。z 只有三維時使用
+struct DirectSources {
+    std::vector<double> x, y, z, gm;
+    int n = 0;          // 實際來源數
+    int padded = 0;     // 補齊後的長度
+};
+
+template <int D>
+void gatherDirectSources(const NodeT<D>* root, const BodyHotT<D>* bodies, int n, DirectSources* src);
+// 以所有來源直接計算陣列索引落在 [lo, hi) 的粒子所受的力，結果存到 forces[b - lo]；
+// 給定 active 時只計算 active[b] 非 0 的粒子
+template <int D>
+void computeForcesDirect(const DirectSources* src, ThreadPool* pool, BodiesT<D>* bodies,
+                         int lo, int hi, vec_t<D>* forces, const uint8_t* active);
+
+#endif // DIRECT_FORCE_H
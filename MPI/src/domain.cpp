@@ -0,0 +1,134 @@
+#include "domain.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include "common.h"
+
+template <int D>
+void boundingBox(ThreadPool* pool, const BodyHotT<D>* bodies, int n, double* box) {
+    const double inf = std::numeric_limits<double>::infinity();
+    std::array<double, 2 * D> empty;
+    for (int k = 0; k < D; k++) {
+        empty[k] = inf;
+        empty[D + k] = -inf;
+    }
+    std::vector<std::array<double, 2 * D>> partial(pool->size(), empty);
+    pool->parallel_for(n, DEFAULT_CHUNK, [&](int begin, int end, int tid) {
+        std::array<double, 2 * D>& b = partial[tid];
+        for (int i = begin; i < end; i++) {
+            const BodyHotT<D>* p = &bodies[i];
+            if (p->mass == OUT_OF_BOUNDS_MASS) continue;
+            for (int k = 0; k < D; k++) {
+                b[k] = std::min(b[k], p->pos(k));
+                b[D + k] = std::max(b[D + k], p->pos(k));
+            }
+        }
+    });
+    for (int k = 0; k < D; k++) {
+        box[k] = inf;
+        box[D + k] = -inf;
+    }
+    for (const std::array<double, 2 * D>& b : partial) {
+        for (int k = 0; k < D; k++) {
+            box[k] = std::min(box[k], b[k]);
+            box[D + k] = std::max(box[D + k], b[D + k]);
+        }
+    }
+}
+
+// 樹的節點都是正方形 (立方體)，取最長的一邊；只有一點時給一個單位大小的盒子
+template <int D>
+void setRootBox(TreeT<D>* tree, const double* box) {
+    if (box[0] > box[D]) {
+        for (int k = 0; k < D; k++) {
+            tree->root_min[k] = MIN_X;
+        }
+        tree->root_size = MAX_X - MIN_X;
+        return;
+    }
+    double size = box[D] - box[0];
+    for (int k = 1; k < D; k++) {
+        size = std::max(size, box[D + k] - box[k]);
+    }
+    if (size <= 0.0) {
+        size = 1.0;
+    }
+    // x0 + size 捨入後可能略小於 x1，放大到確實包住所有粒子 (放大不會讓已包住的軸失效，逐軸處理即可)
+    for (int k = 0; k < D; k++) {
+        while (box[k] + size < box[D + k]) {
+            size = std::nextafter(size, HUGE_VAL);
+        }
+    }
+    for (int k = 0; k < D; k++) {
+        tree->root_min[k] = box[k];
+    }
+    tree->root_size = size;
+}
+
+template <int D>
+bool rootContains(const TreeT<D>* tree, const double* box) {
+    if (tree->n_nodes == 0) {
+        return false;
+    }
+    if (box[0] > box[D]) {
+        return true;
+    }
+    const NodeT<D>* root = tree_root(tree);
+    for (int k = 0; k < D; k++) {
+        if (!(box[k] >= root->min_bound[k] && box[D + k] <= root->max_bound[k])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <int D>
+int compactBodies(BodiesT<D>* bodies, int n, std::vector<int32_t>* slot) {
+    std::vector<BodyHotT<D>>& hot = bodies->hot;
+    std::vector<BodyColdT<D>>& cold = bodies->cold;
+    int live = 0;
+    while (live < n && hot[live].mass != OUT_OF_BOUNDS_MASS) {
+        live++;
+    }
+    if (live == n) {
+        return n;
+    }
+    // 第一個超出邊界的粒子之後才需要搬動；超出邊界的粒子依序接在尾端
+    std::vector<BodyHotT<D>> dead_hot;
+    std::vector<BodyColdT<D>> dead_cold;
+    std::vector<int32_t> dead_slot;
+    for (int i = live; i < n; i++) {
+        if (hot[i].mass == OUT_OF_BOUNDS_MASS) {
+            dead_hot.push_back(hot[i]);
+            dead_cold.push_back(cold[i]);
+            dead_slot.push_back((*slot)[i]);
+        } else {
+            hot[live] = hot[i];
+            cold[live] = cold[i];
+            (*slot)[live] = (*slot)[i];
+            live++;
+        }
+    }
+    std::copy(dead_hot.begin(), dead_hot.end(), hot.begin() + live);
+    std::copy(dead_cold.begin(), dead_cold.end(), cold.begin() + live);
+    std::copy(dead_slot.begin(), dead_slot.end(), slot->begin() + live);
+    return live;
+}
+
+template <int D>
+void restoreOrder(const BodiesT<D>& bodies, int n, const std::vector<int32_t>& slot, particle_t<D>* out) {
+    for (int i = 0; i < n; i++) {
+        joinBodies(bodies, i, 1, &out[slot[i]]);
+    }
+}
+
+#define INSTANTIATE_DOMAIN(D)                                                                                  \
+    template void boundingBox<D>(ThreadPool*, const BodyHotT<D>*, int, double*);                               \
+    template void setRootBox<D>(TreeT<D>*, const double*);                                                     \
+    template bool rootContains<D>(const TreeT<D>*, const double*);                                             \
+    template int compactBodies<D>(BodiesT<D>*, int, std::vector<int32_t>*);                                    \
+    template void restoreOrder<D>(const BodiesT<D>&, int, const std::vector<int32_t>&, particle_t<D>*);
+
+INSTANTIATE_DOMAIN(2)
+INSTANTIATE_DOMAIN(3)
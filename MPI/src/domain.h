@@ -0,0 +1,32 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <cstdint>
+#include <vector>
+#include "bodies.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+// --domain adaptive：根節點每步取所有仍在模擬中的粒子的外接正方形 (三維為立方體)，而不是固定的 [MIN_X, MAX_X]^D。
+// D 維的外接矩形以 2D 個數表示：前 D 個為各軸最小值、後 D 個為最大值 (二維即 {x0, y0, x1, y1})，沒有粒子時 x0 > x1。
+
+// 以執行緒池平行求 bodies[0, n) 中未超出邊界粒子的外接矩形 (各執行緒先各自求，再合併)
+template <int D>
+void boundingBox(ThreadPool* pool, const BodyHotT<D>* bodies, int n, double* box);
+// 依外接矩形設定樹的根節點：以最小值的角為角、邊長為最長的一邊，下一次建樹時生效；沒有粒子時用固定領域
+template <int D>
+void setRootBox(TreeT<D>* tree, const double* box);
+// 外接矩形是否仍在目前這棵樹的根節點內 (refit 可沿用這棵樹)
+template <int D>
+bool rootContains(const TreeT<D>* tree, const double* box);
+
+// 把 bodies[0, n) 中已超出邊界的粒子移到尾端，其餘粒子保持原本的相對順序，回傳仍在模擬中的粒子數。
+// slot[i] 記錄位置 i 的粒子在輸入檔中的位置，與粒子一起搬動。超出邊界的粒子不再更新，
+// 之後只需處理前段；呼叫端只傳入前段，先前移到尾端的粒子就不會再被掃描
+template <int D>
+int compactBodies(BodiesT<D>* bodies, int n, std::vector<int32_t>* slot);
+// 依 slot 把粒子排回輸入檔的順序並轉回 particle，寫到 out (寫檢查點與輸出時使用)
+template <int D>
+void restoreOrder(const BodiesT<D>& bodies, int n, const std::vector<int32_t>& slot, particle_t<D>* out);
+
+#endif // DOMAIN_H
@@ -0,0 +1,396 @@
+#include "domain_mpi.h"
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "common.h"
+#include "balance.h"
+#include "checkpoint.h"
+#include "domain.h"
+#include "integrator.h"
+#include "flat_tree.h"
+#include "force.h"
+#include "io.h"
+#include "io_mpi.h"
+#include "morton.h"
+#include "profile.h"
+#include "parallel_mpi.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+constexpr int SAMPLES_PER_RANK = 64;    // 每個 rank 提供給分割點估計的樣本數
+
+// 依 keys 做加權樣本排序 (sample sort)：各 rank 依累積權重取等距樣本，
+// 每個樣本代表相同的權重；全體樣本排序後在累積權重的 1/P, 2/P, ... 處取分割點，
+// 再以 MPI_Alltoallv 搬移粒子 (熱、冷資料各一次)。balance 時權重為上一步的交互作用次數 + 1，否則每個粒子都是 1。
+static void redistribute(Bodies* local, const std::vector<uint64_t>& keys, int num_procs, bool balance) {
+    int n = local->size();
+
+    std::vector<std::pair<uint64_t, double>> sorted(n);
+    double local_weight = 0.0;
+    for (int i = 0; i < n; i++) {
+        sorted[i] = {keys[i], balance ? local->cold[i].cost + 1.0 : 1.0};
+        local_weight += sorted[i].second;
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    int n_samples = n < SAMPLES_PER_RANK ? n : SAMPLES_PER_RANK;
+    std::vector<uint64_t> samples(n_samples);
+    std::vector<double> sample_weights(n_samples, n_samples > 0 ? local_weight / n_samples : 0.0);
+    double acc = 0.0;
+    int next = 0;
+    for (int i = 0; i < n && next < n_samples; i++) {
+        acc += sorted[i].second;
+        while (next < n_samples && acc > local_weight * next / n_samples) {
+            samples[next++] = sorted[i].first;
+        }
+    }
+
+    std::vector<int> sample_counts(num_procs), sample_displs(num_procs);
+    MPI_Allgather(&n_samples, 1, MPI_INT, sample_counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    int total = 0;
+    for (int r = 0; r < num_procs; r++) {
+        sample_displs[r] = total;
+        total += sample_counts[r];
+    }
+    std::vector<uint64_t> all_samples(total);
+    std::vector<double> all_weights(total);
+    MPI_Allgatherv(samples.data(), n_samples, MPI_UINT64_T, all_samples.data(),
+                   sample_counts.data(), sample_displs.data(), MPI_UINT64_T, MPI_COMM_WORLD);
+    MPI_Allgatherv(sample_weights.data(), n_samples, MPI_DOUBLE, all_weights.data(),
+                   sample_counts.data(), sample_displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+    std::vector<std::pair<uint64_t, double>> merged(total);
+    double total_weight = 0.0;
+    for (int i = 0; i < total; i++) {
+        merged[i] = {all_samples[i], all_weights[i]};
+        total_weight += all_weights[i];
+    }
+    std::sort(merged.begin(), merged.end());
+
+    std::vector<uint64_t> splitters(num_procs - 1, ~0ULL);
+    acc = 0.0;
+    int r = 1;
+    for (int i = 0; i < total && r < num_procs; i++) {
+        while (r < num_procs && acc >= total_weight * r / num_procs) {
+            splitters[r - 1] = merged[i].first;
+            r++;
+        }
+        acc += merged[i].second;
+    }
+
+    // 依目的 rank 分桶
+    std::vector<int> dest(n), send_counts(num_procs, 0), send_displs(num_procs);
+    for (int i = 0; i < n; i++) {
+        dest[i] = (int)(std::upper_bound(splitters.begin(), splitters.end(), keys[i]) - splitters.begin());
+        send_counts[dest[i]]++;
+    }
+    int offset = 0;
+    for (int r = 0; r < num_procs; r++) {
+        send_displs[r] = offset;
+        offset += send_counts[r];
+    }
+    Bodies sendbuf;
+    sendbuf.resize(n);
+    std::vector<int> fill(send_displs);
+    for (int i = 0; i < n; i++) {
+        int k = fill[dest[i]]++;
+        sendbuf.hot[k] = local->hot[i];
+        sendbuf.cold[k] = local->cold[i];
+    }
+
+    std::vector<int> recv_counts(num_procs), recv_displs(num_procs);
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    offset = 0;
+    for (int r = 0; r < num_procs; r++) {
+        recv_displs[r] = offset;
+        offset += recv_counts[r];
+    }
+    local->resize(offset);
+    MPI_Alltoallv(sendbuf.hot.data(), send_counts.data(), send_displs.data(), mpiBodyHot,
+                  local->hot.data(), recv_counts.data(), recv_displs.data(), mpiBodyHot, MPI_COMM_WORLD);
+    MPI_Alltoallv(sendbuf.cold.data(), send_counts.data(), send_displs.data(), mpiBodyCold,
+                  local->cold.data(), recv_counts.data(), recv_displs.data(), mpiBodyCold, MPI_COMM_WORLD);
+}
+
+// 把所有 rank 的粒子收集到 rank 0 的 all，依 index 排回輸入檔的順序
+static void gatherSorted(const Bodies& local, int rank, int num_procs, std::vector<particle>* all) {
+    int n_local = local.size();
+    std::vector<particle> mine(n_local);
+    joinBodies(local, 0, n_local, mine.data());
+    std::vector<int> counts(num_procs), displs(num_procs);
+    MPI_Gather(&n_local, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        int offset = 0;
+        for (int r = 0; r < num_procs; r++) {
+            displs[r] = offset;
+            offset += counts[r];
+        }
+        all->resize(offset);
+    }
+    MPI_Gatherv(mine.data(), n_local, mpiBody, all->data(), counts.data(), displs.data(), mpiBody, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        std::sort(all->begin(), all->end(), [](const particle& a, const particle& b) { return a.index < b.index; });
+    }
+}
+
+// 本地粒子的外接矩形 {x0, y0, x1, y1}；沒有粒子時 x0 > x1
+static void localBox(const Bodies& local, double box[4]) {
+    const double inf = std::numeric_limits<double>::infinity();
+    box[0] = box[1] = inf;
+    box[2] = box[3] = -inf;
+    for (const BodyHot& b : local.hot) {
+        if (b.mass == OUT_OF_BOUNDS_MASS) continue;
+        box[0] = b.x < box[0] ? b.x : box[0];
+        box[1] = b.y < box[1] ? b.y : box[1];
+        box[2] = b.x > box[2] ? b.x : box[2];
+        box[3] = b.y > box[3] ? b.y : box[3];
+    }
+}
+
+// 所有 rank 粒子的外接矩形：最大值取負號後與最小值一起做一次 MPI_MIN
+static void globalBox(const Bodies& local, double box[4]) {
+    localBox(local, box);
+    double v[4] = {box[0], box[1], -box[2], -box[3]};
+    MPI_Allreduce(MPI_IN_PLACE, v, 4, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+    box[0] = v[0];
+    box[1] = v[1];
+    box[2] = -v[2];
+    box[3] = -v[3];
+}
+
+// 對另一個 rank 的外接矩形做 MAC：被接受的節點以 (質心, 質量) 送出，
+// 走到單一粒子則送出粒子本身。對方任何粒子的 MAC 都至少這麼寬鬆，所以這些節點已足夠。
+static void exportEssential(const options_t* opts, const FlatTree* flat, const double box[4], std::vector<double>* out) {
+    const double theta2 = opts->threshold * opts->threshold;
+    int32_t k = 0;
+    while (k < flat->n) {
+        if (flat->size2[k] >= theta2 * boxDistance2(flat->com_x[k], flat->com_y[k], box)) {
+            k++;
+            continue;
+        }
+        out->push_back(flat->com_x[k]);
+        out->push_back(flat->com_y[k]);
+        out->push_back(flat->mass[k]);
+        k = flat->skip[k];
+    }
+}
+
+// 建立本地樹，與其他 rank 交換 locally essential tree，
+// 收到的節點以虛擬粒子 (index = -1) 接在 local 後面
+static void exchangeEssential(const options_t* opts, Bodies* local, int rank, int num_procs,
+                              Tree* localTree, FlatTree* localFlat) {
+    int n_local = local->size();
+    double box[4];
+    localBox(*local, box);
+    std::vector<double> boxes(4 * num_procs);
+    MPI_Allgather(box, 4, MPI_DOUBLE, boxes.data(), 4, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    buildTree(opts, localTree, local, n_local);
+    flattenTree(localTree, localFlat);
+
+    std::vector<double> sendbuf;
+    std::vector<int> send_counts(num_procs, 0), send_displs(num_procs);
+    for (int r = 0; r < num_procs; r++) {
+        send_displs[r] = (int)sendbuf.size();
+        const double* rbox = &boxes[4 * r];
+        if (r != rank && rbox[0] <= rbox[2]) {
+            exportEssential(opts, localFlat, rbox, &sendbuf);
+        }
+        send_counts[r] = (int)sendbuf.size() - send_displs[r];
+    }
+
+    std::vector<int> recv_counts(num_procs), recv_displs(num_procs);
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    int total = 0;
+    for (int r = 0; r < num_procs; r++) {
+        recv_displs[r] = total;
+        total += recv_counts[r];
+    }
+    std::vector<double> recvbuf(total);
+    MPI_Alltoallv(sendbuf.data(), send_counts.data(), send_displs.data(), MPI_DOUBLE,
+                  recvbuf.data(), recv_counts.data(), recv_displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+
+    local->resize(n_local + total / 3);
+    for (int j = 0; j < total / 3; j++) {
+        BodyHot* h = &local->hot[n_local + j];
+        BodyCold* c = &local->cold[n_local + j];
+        h->x = recvbuf[3 * j];
+        h->y = recvbuf[3 * j + 1];
+        h->mass = recvbuf[3 * j + 2];
+        c->index = -1;
+        c->v_x = c->v_y = 0.0;
+        c->a_x = c->a_y = 0.0;
+        c->cost = 0;
+    }
+}
+
+int parallel_mpi_domain(options_t* opts, int rank, int num_procs) {
+    double start_time, stop_time;
+    RunProfile profile;
+    struct particle *slice = NULL;
+    int n_local;
+    ForceEngine engine;
+    Tree localTree;
+    FlatTree localFlat;
+    ThreadPool pool(opts->n_threads);
+
+    // 每個 rank 只保留檔案中屬於自己的一段
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        read_file_slice_mpi(opts, rank, num_procs, &slice, &n_local);
+    }
+    Bodies local;
+    splitBodies(slice, n_local, &local);
+    free(slice);
+
+    // 超出邊界的粒子不再重新分配、建樹或更新，留在原本的 rank 直到寫檢查點與輸出
+    Bodies retired;
+    auto retire = [&]() {
+        int kept = 0;
+        for (int i = 0; i < local.size(); i++) {
+            if (local.hot[i].mass == OUT_OF_BOUNDS_MASS) {
+                retired.hot.push_back(local.hot[i]);
+                retired.cold.push_back(local.cold[i]);
+            } else {
+                local.hot[kept] = local.hot[i];
+                local.cold[kept] = local.cold[i];
+                kept++;
+            }
+        }
+        local.resize(kept);
+    };
+    auto withRetired = [&]() {
+        Bodies mine(local);
+        mine.hot.insert(mine.hot.end(), retired.hot.begin(), retired.hot.end());
+        mine.cold.insert(mine.cold.end(), retired.cold.begin(), retired.cold.end());
+        return mine;
+    };
+    retire();
+
+    // 每步的粒子集合都不同，不能沿用上一步的樹
+    options_t step_opts = *opts;
+    step_opts.refit_every = 0;
+
+    // Morton 鍵的範圍；自適應領域每步改成所有 rank 粒子的外接正方形
+    Node box;
+    memset(&box, 0, sizeof(Node));
+    box.min_bound[0] = MIN_X;
+    box.min_bound[1] = MIN_Y;
+    box.max_bound[0] = MAX_X;
+    box.max_bound[1] = MAX_Y;
+
+    initializeMPITypes();
+    MPI_Barrier(MPI_COMM_WORLD);
+    start_time = MPI_Wtime();
+
+    CheckpointWriter checkpoint(checkpointPath(opts));
+    std::vector<particle> all;
+    for (int s = firstIteration(opts); s < endIteration(opts); s++) {
+        {
+            // 重新分配與交換本質樹 (其中建本地樹與攤平的時間也算在通訊階段)
+            PhaseTimer timer(&profile, PHASE_COMM);
+            if (opts->domain == "adaptive") {
+                double gbox[4];
+                globalBox(local, gbox);
+                setRootBox(&localTree, gbox);
+                box.min_bound[0] = localTree.root_min[0];
+                box.min_bound[1] = localTree.root_min[1];
+                box.max_bound[0] = localTree.root_min[0] + localTree.root_size;
+                box.max_bound[1] = localTree.root_min[1] + localTree.root_size;
+            }
+            std::vector<uint64_t> keys(local.size());
+            for (int i = 0; i < local.size(); i++) {
+                keys[i] = mortonKey(&box, local.hot[i].x, local.hot[i].y);
+            }
+            redistribute(&local, keys, num_procs, opts->balance);
+            n_local = local.size();
+            exchangeEssential(&step_opts, &local, rank, num_procs, &localTree, &localFlat);
+        }
+
+        {
+            PhaseTimer timer(&profile, PHASE_BUILD);
+            buildForceTree(&step_opts, &engine, &pool, &local, local.size(), s);
+        }
+        profileTree(opts, &profile, &engine.tree);
+
+        std::vector<std::array<double, 2>> forces(n_local, std::array<double, 2>{0, 0});
+        {
+            PhaseTimer timer(&profile, PHASE_FORCE);
+            computeForces(&step_opts, &engine, &pool, 0, n_local, forces.data());
+        }
+        profileBodies(&profile, local.cold.data(), 0, n_local);
+        profile.steps++;
+
+        {
+            PhaseTimer timer(&profile, PHASE_UPDATE);
+            pool.parallel_for(n_local, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                for (int i = begin; i < end; i++) {
+                    advanceBody(opts, &local.hot[i], &local.cold[i], s, tree_root(&engine.tree));
+                }
+            });
+        }
+
+        releaseForceTree(&step_opts, &engine);
+        local.resize(n_local); // 丟掉收到的虛擬粒子
+        retire();
+
+        int done = completedStep(opts, s);
+        if (checkpointDue(opts, done)) {
+            PhaseTimer timer(&profile, PHASE_IO);
+            gatherSorted(withRetired(), rank, num_procs, &all);
+            if (rank == 0) {
+                checkpoint.write(all.data(), (int)all.size(), done);
+            }
+        }
+    }
+
+    stop_time = MPI_Wtime();
+    profile.wall_time = stop_time - start_time;
+
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        local = withRetired();
+        if (isSnapshotPath(opts->out_file)) {
+            // 以 index 為鍵再做一次樣本排序，每個 rank 拿到連續的一段 index，
+            // 排好後以 MPI-IO 寫到自己的位移，不經過 rank 0
+            std::vector<uint64_t> keys(local.size());
+            for (int i = 0; i < local.size(); i++) {
+                keys[i] = (uint64_t)((int64_t)local.cold[i].index - INT32_MIN);
+            }
+            redistribute(&local, keys, num_procs, false);
+            int count = local.size(), offset = 0;
+            std::vector<particle> out(count);
+            joinBodies(local, 0, count, out.data());
+            std::sort(out.begin(), out.end(), [](const particle& a, const particle& b) { return a.index < b.index; });
+            MPI_Exscan(&count, &offset, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+            if (rank == 0) {
+                offset = 0;
+                printf("%f\n", (stop_time - start_time));
+                TIMING_PRINT(printf("Communication: %f s\n", profile.phase_time[PHASE_COMM]));
+            }
+            write_snapshot_mpi(opts, out.data(), offset, count);
+        } else {
+            // 輸出前把所有粒子收集到 rank 0，依 index 排回原本順序
+            gatherSorted(local, rank, num_procs, &all);
+            if (rank == 0) {
+                printf("%f\n", (stop_time - start_time));
+                TIMING_PRINT(printf("Communication: %f s\n", profile.phase_time[PHASE_COMM]));
+                write_file_parallel(opts, all.data());
+            }
+        }
+    }
+    reportImbalance(opts, profile.phase_time[PHASE_FORCE], profile.interactions, rank, num_procs);
+    reportPrecision(opts, &engine, rank);
+    writeProfile(opts, &profile, opts->n_particles, rank, num_procs);
+
+    freeMPITypes();
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef DOMAIN_MPI_H
+#define DOMAIN_MPI_H
+
+#include "argparse.h"
+#include "particle.h"
+#include <mpi.h>
+
+// 空間分割版本：每個 rank 只持有自己 Morton 區段內的粒子，
+// 以 locally essential tree 交換其他 rank 需要的節點
+int parallel_mpi_domain(options_t* opts, int rank, int num_procs);
+
+#endif // DOMAIN_MPI_H
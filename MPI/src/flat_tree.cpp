@@ -0,0 +1,187 @@
+#include "flat_tree.h"
+#include <cmath>
+#include "common.h"
+#include "quadrupole.h"
+
+template <int D>
+static int32_t emitNode(FlatTree* flat, const double* pos, double mass, double size2, const double* quad) {
+    int32_t k = flat->n++;
+    if ((size_t)flat->n > flat->skip.size()) {
+        size_t cap = flat->skip.size() * 2 + 64;
+        if (flat->mixed) {
+            flat->com_xf.resize(cap);
+            flat->com_yf.resize(cap);
+            flat->mass_f.resize(cap);
+            flat->size2_f.resize(cap);
+        } else {
+            flat->com_x.resize(cap);
+            flat->com_y.resize(cap);
+            if (D == 3) flat->com_z.resize(cap);
+            flat->mass.resize(cap);
+            flat->size2.resize(cap);
+        }
+        flat->skip.resize(cap);
+        flat->first.resize(cap);
+        flat->count.resize(cap);
+    }
+    if (flat->mixed) {
+        flat->com_xf[k] = (float)(pos[0] - flat->origin[0]);
+        flat->com_yf[k] = (float)(pos[1] - flat->origin[1]);
+        flat->mass_f[k] = (float)mass;
+        flat->size2_f[k] = (float)size2;
+    } else {
+        flat->com_x[k] = pos[0];
+        flat->com_y[k] = pos[1];
+        if constexpr (D == 3) {
+            flat->com_z[k] = pos[2];
+        }
+        flat->mass[k] = mass;
+        flat->size2[k] = size2;
+    }
+    flat->first[k] = (int32_t)flat->bodies.size();
+    if (flat->quadrupole) {
+        if ((size_t)flat->n > flat->qxx.size()) {
+            flat->qxx.resize(flat->skip.size());
+            flat->qxy.resize(flat->skip.size());
+            flat->qyy.resize(flat->skip.size());
+        }
+        flat->qxx[k] = quad ? quad[0] : 0.0;
+        flat->qxy[k] = quad ? quad[1] : 0.0;
+        flat->qyy[k] = quad ? quad[2] : 0.0;
+    }
+    return k;
+}
+
+// 葉節點中的每個粒子各自成為一個 size2 = -1 的節點，打開葉節點即是直接加總
+template <int D>
+static void emitBody(const TreeT<D>* tree, int32_t b, FlatTree* flat) {
+    const BodyHotT<D>* p = &tree->bodies->hot[b];
+    double pos[D];
+    for (int i = 0; i < D; i++) {
+        pos[i] = p->pos(i);
+    }
+    int32_t k = emitNode<D>(flat, pos, p->mass, -1.0, nullptr);
+    flat->bodies.push_back(b);
+    flat->skip[k] = flat->n;
+    flat->count[k] = 1;
+}
+
+template <int D>
+static void flattenNode(const TreeT<D>* tree, int32_t n, FlatTree* flat) {
+    const NodeT<D>* node = &tree->nodes[n];
+    if (node->count == 0) return; // 空葉節點不放入
+    if (!node->has_children && node->count == 1) {
+        emitBody(tree, tree->order[node->first], flat);
+        return;
+    }
+
+    const double* quad = flat->quadrupole ? tree->quad[n].data() : nullptr;
+    int32_t k = emitNode<D>(flat, node->com, node->mass, node->s * node->s, quad);
+    if (node->has_children) {
+        for (int c = 0; c < NodeT<D>::N_CHILDREN; c++) {
+            flattenNode(tree, node->chd[c], flat);
+        }
+    } else {
+        for (int i = 0; i < node->count; i++) {
+            emitBody(tree, tree->order[node->first + i], flat);
+        }
+    }
+    flat->skip[k] = flat->n;
+    flat->count[k] = (int32_t)flat->bodies.size() - flat->first[k];
+}
+
+// 由節點池建立前序排列的 SoA 陣列，陣列容量在各步之間重複使用。
+// mixed 時節點改存 float，位置以根節點中心為原點，float 的捨入誤差不隨座標的大小放大
+template <int D>
+void flattenTree(const TreeT<D>* tree, FlatTree* flat, bool mixed) {
+    if (mixed != flat->mixed) {
+        flat->skip.clear();     // 換精度時重新配置陣列
+    }
+    flat->n = 0;
+    flat->bodies.clear();
+    flat->quadrupole = !tree->quad.empty();
+    flat->mixed = mixed;
+    if (tree->n_nodes > 0) {
+        const NodeT<D>* root = tree_root(tree);
+        flat->origin[0] = 0.5 * (root->min_bound[0] + root->max_bound[0]);
+        flat->origin[1] = 0.5 * (root->min_bound[1] + root->max_bound[1]);
+        flattenNode(tree, 0, flat);
+    }
+}
+
+// 非遞迴版本的 compute_force_v2：
+// MAC 以平方比較 (s^2 < θ^2 d^2)，只有被接受的節點才需要開根號與一次除法。
+// 三維只多一個 z 分量，由 if constexpr 在編譯期決定，二維的計算與原本相同
+template <int D>
+vec_t<D> compute_force_flat(const options_t* opts, const FlatTree* flat, BodiesT<D>* bodies, int32_t b) {
+    const BodyHotT<D>* body = &bodies->hot[b];
+    if (body->mass == OUT_OF_BOUNDS_MASS) {
+        return {};
+    }
+
+    const double* com_x = flat->com_x.data();
+    const double* com_y = flat->com_y.data();
+    const double* com_z = flat->com_z.data();
+    const double* mass = flat->mass.data();
+    const double* size2 = flat->size2.data();
+    const int32_t* skip = flat->skip.data();
+    const double* qxx = flat->quadrupole ? flat->qxx.data() : nullptr;
+    const double theta2 = opts->threshold * opts->threshold;
+    const double x = body->x, y = body->y;
+    double z = 0.0;
+    if constexpr (D == 3) {
+        z = body->z;
+    }
+
+    double ax = 0.0, ay = 0.0, az = 0.0;
+    int visits = 0;
+    int32_t k = 0;
+    while (k < flat->n) {
+        double dx = com_x[k] - x;
+        double dy = com_y[k] - y;
+        double d2 = dx * dx + dy * dy;
+        double dz = 0.0;
+        if constexpr (D == 3) {
+            dz = com_z[k] - z;
+            d2 += dz * dz;
+        }
+        if (size2[k] >= theta2 * d2) {
+            k++; // 打開節點
+            continue;
+        }
+        if (d2 > 0.0) {
+            double d = sqrt(d2);
+            double r = d >= RLIMIT ? d : RLIMIT;
+            double s = G * mass[k] / (d * r * r);
+            ax += s * dx;
+            ay += s * dy;
+            if constexpr (D == 3) {
+                az += s * dz;
+            }
+            // 粒子本身 (size2 < 0) 沒有四極矩；RLIMIT 內的力已被截斷，不加修正
+            if (D == 2 && qxx && size2[k] > 0 && d >= RLIMIT) {
+                quadrupoleAccel(-dx, -dy, d, qxx[k], flat->qxy[k], flat->qyy[k], &ax, &ay);
+            }
+        }
+        visits++;
+        k = skip[k];
+    }
+
+    BodyColdT<D>* cold = &bodies->cold[b];
+    cold->cost = visits;
+    cold->a_x = ax;
+    cold->a_y = ay;
+    if constexpr (D == 3) {
+        cold->a_z = az;
+        return {{ax * body->mass, ay * body->mass, az * body->mass}};
+    } else {
+        return {{ax * body->mass, ay * body->mass}};
+    }
+}
+
+#define INSTANTIATE_FLAT(D)                                                                        \
+    template void flattenTree<D>(const TreeT<D>*, FlatTree*, bool);                                \
+    template vec_t<D> compute_force_flat<D>(const options_t*, const FlatTree*, BodiesT<D>*, int32_t);
+
+INSTANTIATE_FLAT(2)
+INSTANTIATE_FLAT(3)
@@ -0,0 +1,59 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "argparse.h"
+#include "bodies.h"
+#include "tree.h"
+
+// 攤平成結構陣列 (SoA) 的四叉樹 (三維為八叉樹)，節點依深度優先前序排列。
+// 打開節點時前往 k + 1 (第一個子節點)，接受節點時跳到 skip[k] (子樹之後的下一個節點)，
+// 因此走訪不需要遞迴也不需要堆疊。單一粒子的節點 size2 設為 -1，永遠會被接受；
+// 多粒子的葉節點後面緊接著它的各個粒子，打開葉節點就是直接加總。
+// 與粒子本身重合 (距離為 0) 的節點不計入，不需再比對粒子索引。
+struct FlatTree {
+    int32_t n = 0;
+    std::vector<double> com_x, com_y;
+    std::vector<double> com_z;     // 只有三維時使用
+    std::vector<double> mass;
+    std::vector<double> size2;     // 節點大小的平方，葉節點為 -1
+    std::vector<int32_t> skip;
+    // 四極矩，只在 (二維的) 樹有計算四極矩時填入 (粒子本身為 0)
+    bool quadrupole = false;
+    std::vector<double> qxx, qxy, qyy;
+    // --precision mixed (二維 group 模式)：質心 (相對於根節點中心 origin)、質量與大小改存 float，
+    // 上面四個 double 陣列不使用
+    bool mixed = false;
+    double origin[2] = {0.0, 0.0};
+    std::vector<float> com_xf, com_yf;
+    std::vector<float> mass_f, size2_f;
+
+    // 每個節點子樹內的粒子為 bodies[first[k] .. first[k] + count[k])，依前序排列
+    std::vector<int32_t> first, count;
+    std::vector<int32_t> bodies;
+};
+
+// 點 (x, y) 到外接矩形 box = {x0, y0, x1, y1} 的最短距離平方，點在矩形內時為 0 (mixed 時以 float 計算)
+template <typename Real>
+inline Real boxDistance2(Real x, Real y, const Real box[4]) {
+    Real dx = box[0] - x > 0 ? box[0] - x : (x - box[2] > 0 ? x - box[2] : Real(0));
+    Real dy = box[1] - y > 0 ? box[1] - y : (y - box[3] > 0 ? y - box[3] : Real(0));
+    return dx * dx + dy * dy;
+}
+
+// 三維版本：box = {x0, y0, z0, x1, y1, z1}
+inline double boxDistance2(double x, double y, double z, const double box[6]) {
+    double dx = box[0] - x > 0 ? box[0] - x : (x - box[3] > 0 ? x - box[3] : 0.0);
+    double dy = box[1] - y > 0 ? box[1] - y : (y - box[4] > 0 ? y - box[4] : 0.0);
+    double dz = box[2] - z > 0 ? box[2] - z : (z - box[5] > 0 ? z - box[5] : 0.0);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+template <int D>
+void flattenTree(const TreeT<D>* tree, FlatTree* flat, bool mixed = false);
+template <int D>
+vec_t<D> compute_force_flat(const options_t* opts, const FlatTree* flat, BodiesT<D>* bodies, int32_t b);
+
+#endif // FLAT_TREE_H
@@ -0,0 +1,426 @@
+#include "fmm.h"
+#include <cmath>
+
+// 多重指標 (a, b) 在係數陣列中的位置：依總階數 n = a + b 排列，同階內依 b 遞增
+static inline int termIndex(int a, int b) {
+    int n = a + b;
+    return n * (n + 1) / 2 + b;
+}
+
+static double binomial(int n, int k) {
+    double c = 1.0;
+    for (int i = 1; i <= k; i++) {
+        c = c * (n - k + i) / i;
+    }
+    return c;
+}
+
+// x^a y^b，a + b <= order
+static void monomials(int order, double x, double y, double* out) {
+    out[0] = 1.0;
+    for (int n = 1; n <= order; n++) {
+        for (int b = 0; b <= n; b++) {
+            int a = n - b;
+            out[termIndex(a, b)] = b == 0 ? out[termIndex(a - 1, 0)] * x : out[termIndex(a, b - 1)] * y;
+        }
+    }
+}
+
+// f(x, y) = (x² + y²)^(-1/2) 的泰勒係數 T_(a,b) = ∂x^a ∂y^b f / (a! b!)，以遞迴式
+//   r² T_k = -(2 - 1/n) (x T_(k-ex) + y T_(k-ey)) - (1 - 1/n) (T_(k-2ex) + T_(k-2ey))，n = |k|
+static void derivatives(int order, double x, double y, double* out) {
+    double r2 = x * x + y * y;
+    out[0] = 1.0 / std::sqrt(r2);
+    for (int n = 1; n <= order; n++) {
+        double c1 = 2.0 - 1.0 / n;
+        double c2 = 1.0 - 1.0 / n;
+        for (int b = 0; b <= n; b++) {
+            int a = n - b;
+            double first = 0.0, second = 0.0;
+            if (a >= 1) first += x * out[termIndex(a - 1, b)];
+            if (b >= 1) first += y * out[termIndex(a, b - 1)];
+            if (a >= 2) second += out[termIndex(a - 2, b)];
+            if (b >= 2) second += out[termIndex(a, b - 2)];
+            out[termIndex(a, b)] = -(c1 * first + c2 * second) / r2;
+        }
+    }
+}
+
+// shift：(p + d)^h = Σ_(l <= h) C(h, l) p^l d^(h-l)，M2M 時 out = h、in = l，L2L 反過來使用。
+// m2l：f(R + u - v) 展開後 u^α v^β 的係數為 (-1)^|β| C(α + β, α) T_(α+β)(R)
+static void buildTables(int order, FmmTree* fmm) {
+    fmm->order = order;
+    fmm->terms = (order + 1) * (order + 2) / 2;
+    fmm->shift.clear();
+    fmm->m2l.clear();
+    for (int hn = 0; hn <= order; hn++) {
+        for (int hb = 0; hb <= hn; hb++) {
+            int ha = hn - hb;
+            for (int la = 0; la <= ha; la++) {
+                for (int lb = 0; lb <= hb; lb++) {
+                    double coef = binomial(ha, la) * binomial(hb, lb);
+                    fmm->shift.push_back({termIndex(ha, hb), termIndex(la, lb), termIndex(ha - la, hb - lb), coef});
+                }
+            }
+        }
+    }
+    for (int an = 0; an <= order; an++) {
+        for (int ab = 0; ab <= an; ab++) {
+            int aa = an - ab;
+            for (int bn = 0; an + bn <= order; bn++) {
+                for (int bb = 0; bb <= bn; bb++) {
+                    int ba = bn - bb;
+                    double coef = binomial(aa + ba, aa) * binomial(ab + bb, ab) * (bn % 2 ? -1.0 : 1.0);
+                    fmm->m2l.push_back({termIndex(aa, ab), termIndex(ba, bb), termIndex(aa + ba, ab + bb), coef});
+                }
+            }
+        }
+    }
+}
+
+// 子節點的索引一定大於父節點，倒序掃描節點池即是由下而上。
+// 葉節點直接由粒子加總 (P2M)；內部節點把子節點的多極矩平移到自己的質心 (M2M)
+void computeMultipoles(const options_t* opts, const Tree* tree, FmmTree* fmm) {
+    if (fmm->order != opts->fmm_order) {
+        buildTables(opts->fmm_order, fmm);
+    }
+    const int order = fmm->order;
+    const int terms = fmm->terms;
+    fmm->multipole.assign((size_t)tree->n_nodes * terms, 0.0);
+    fmm->local.resize((size_t)tree->n_nodes * terms);
+    fmm->radius.assign(tree->n_nodes, 0.0);
+    fmm->inherited.resize(tree->n_nodes);
+    fmm->needed.resize(tree->n_nodes);
+
+    double powers[(MAX_FMM_ORDER + 1) * (MAX_FMM_ORDER + 2) / 2];
+    for (int32_t n = tree->n_nodes - 1; n >= 0; n--) {
+        const Node* node = &tree->nodes[n];
+        if (node->count == 0) continue;
+        double* m = &fmm->multipole[(size_t)n * terms];
+        double radius = 0.0;
+        if (node->has_children) {
+            for (int c = 0; c < 4; c++) {
+                const Node* child = &tree->nodes[node->chd[c]];
+                if (child->count == 0) continue;
+                double dx = child->com[0] - node->com[0];
+                double dy = child->com[1] - node->com[1];
+                monomials(order, dx, dy, powers);
+                const double* cm = &fmm->multipole[(size_t)node->chd[c] * terms];
+                for (const FmmTerm& t : fmm->shift) {
+                    m[t.out] += t.coef * cm[t.in] * powers[t.k];
+                }
+                radius = std::max(radius, std::sqrt(dx * dx + dy * dy) + fmm->radius[node->chd[c]]);
+            }
+        } else {
+            for (int i = 0; i < node->count; i++) {
+                const BodyHot* p = &tree->bodies->hot[tree->order[node->first + i]];
+                double dx = p->x - node->com[0];
+                double dy = p->y - node->com[1];
+                monomials(order, dx, dy, powers);
+                for (int k = 0; k < terms; k++) {
+                    m[k] += p->mass * powers[k];
+                }
+                radius = std::max(radius, std::sqrt(dx * dx + dy * dy));
+            }
+        }
+        fmm->radius[n] = radius;
+    }
+}
+
+namespace {
+
+struct FmmTask {
+    int32_t target;
+    std::vector<int32_t> sources;
+};
+
+// 每個執行緒一份：各層待分裂的來源清單與葉節點的暫存
+struct FmmScratch {
+    std::vector<std::vector<int32_t>> pending = std::vector<std::vector<int32_t>>(MAX_TREE_DEPTH + 2);
+    std::vector<double> acc_x, acc_y;
+    std::vector<int> cost;
+};
+
+// 原作公式 (含 RLIMIT 截斷) 的加速度，未乘 G；重合的粒子不計
+static inline void pairAccel(const BodyHot* body, const BodyHot* q, double* ax, double* ay) {
+    double dx = q->x - body->x;
+    double dy = q->y - body->y;
+    double d = std::sqrt(dx * dx + dy * dy);
+    if (d == 0.0) return;
+    double limited = d >= RLIMIT ? d : RLIMIT;
+    double scale = q->mass / (limited * limited * d);
+    *ax += scale * dx;
+    *ay += scale * dy;
+}
+
+struct FmmPass {
+    const options_t* opts;
+    const Tree* tree;
+    FmmTree* fmm;
+    int lo, hi;
+    const uint8_t* active;
+    std::array<double, 2>* forces;
+
+    bool isTarget(int32_t b) const {
+        return b >= lo && b < hi && (!active || active[b]) && tree->bodies->hot[b].mass != OUT_OF_BOUNDS_MASS;
+    }
+
+    // 目標節點 T 與來源節點 S：分得夠開 (兩者半徑和 < θ d) 且所有粒子對的距離都 >= RLIMIT 時做 M2L。
+    // 分得夠開但可能有粒子對落在 RLIMIT 內時，截斷後的力無法展開，T 為葉節點就逐粒子處理。
+    // 兩者都是葉節點時直接相加；否則分裂較大的一方，T 較大 (或 S 已是葉節點) 時把 S 留給 T 的子節點
+    void interact(int32_t t, int32_t s, std::vector<int32_t>* pending, FmmScratch* scratch, int* m2l_count) {
+        const Node* tn = &tree->nodes[t];
+        const Node* sn = &tree->nodes[s];
+        if (sn->count == 0) return;
+        double rx = tn->com[0] - sn->com[0];
+        double ry = tn->com[1] - sn->com[1];
+        double d = std::sqrt(rx * rx + ry * ry);
+        double reach = fmm->radius[t] + fmm->radius[s];
+        if (reach < opts->threshold * d) {
+            if (d - reach >= RLIMIT) {
+                multipoleToLocal(t, s, rx, ry);
+                (*m2l_count)++;
+                return;
+            }
+            if (!tn->has_children && sn->has_children) {
+                multipoleToBodies(t, s, scratch);
+                return;
+            }
+        }
+        if (!tn->has_children && !sn->has_children) {
+            direct(t, s, scratch);
+            return;
+        }
+        if (!sn->has_children || (tn->has_children && tn->s >= sn->s)) {
+            pending->push_back(s);
+            return;
+        }
+        for (int c = 0; c < 4; c++) {
+            interact(t, sn->chd[c], pending, scratch, m2l_count);
+        }
+    }
+
+    void multipoleToLocal(int32_t t, int32_t s, double rx, double ry) {
+        double deriv[(MAX_FMM_ORDER + 1) * (MAX_FMM_ORDER + 2) / 2];
+        derivatives(fmm->order, rx, ry, deriv);
+        double* l = &fmm->local[(size_t)t * fmm->terms];
+        const double* m = &fmm->multipole[(size_t)s * fmm->terms];
+        for (const FmmTerm& term : fmm->m2l) {
+            l[term.out] += term.coef * deriv[term.k] * m[term.in];
+        }
+    }
+
+    // 葉節點 T 的每個粒子分別走訪 S 的子樹：節點整個在粒子的 RLIMIT 外時直接在粒子位置求多極展開的梯度 (M2P)；
+    // 整個在 RLIMIT 內時每個來源的力大小固定，與樹狀演算法相同以質心近似；跨過 RLIMIT 的節點繼續往下，葉節點直接相加
+    void multipoleToBodies(int32_t t, int32_t s, FmmScratch* scratch) {
+        const Node* tn = &tree->nodes[t];
+        for (int i = 0; i < tn->count; i++) {
+            int32_t b = tree->order[tn->first + i];
+            if (!isTarget(b)) continue;
+            nearBody(&tree->bodies->hot[b], b, s, &scratch->acc_x[i], &scratch->acc_y[i], &scratch->cost[i]);
+        }
+    }
+
+    void nearBody(const BodyHot* body, int32_t self, int32_t s, double* ax, double* ay, int* cost) {
+        const Node* sn = &tree->nodes[s];
+        if (sn->count == 0) return;
+        double rx = body->x - sn->com[0];
+        double ry = body->y - sn->com[1];
+        double d = std::sqrt(rx * rx + ry * ry);
+        double r = fmm->radius[s];
+        if (r < opts->threshold * d) {
+            if (d - r >= RLIMIT) {
+                // φ = Σ_β (-1)^|β| M_β T_β(R)，∂x T_(a,b) = (a + 1) T_(a+1,b)
+                double deriv[(MAX_FMM_ORDER + 1) * (MAX_FMM_ORDER + 2) / 2];
+                derivatives(fmm->order, rx, ry, deriv);
+                const double* m = &fmm->multipole[(size_t)s * fmm->terms];
+                for (int n = 0; n < fmm->order; n++) {
+                    double sign = n % 2 ? -1.0 : 1.0;
+                    for (int bb = 0; bb <= n; bb++) {
+                        int aa = n - bb;
+                        double c = sign * m[termIndex(aa, bb)];
+                        *ax += c * (aa + 1) * deriv[termIndex(aa + 1, bb)];
+                        *ay += c * (bb + 1) * deriv[termIndex(aa, bb + 1)];
+                    }
+                }
+                (*cost)++;
+                return;
+            }
+            if (d + r <= RLIMIT) {
+                double scale = sn->mass / (RLIMIT * RLIMIT * d);
+                *ax -= scale * rx;
+                *ay -= scale * ry;
+                (*cost)++;
+                return;
+            }
+        }
+        if (!sn->has_children) {
+            const int32_t* sources = &tree->order[sn->first];
+            for (int j = 0; j < sn->count; j++) {
+                if (sources[j] == self) continue;
+                pairAccel(body, &tree->bodies->hot[sources[j]], ax, ay);
+            }
+            *cost += sn->count;
+            return;
+        }
+        for (int c = 0; c < 4; c++) {
+            nearBody(body, self, sn->chd[c], ax, ay, cost);
+        }
+    }
+
+    // 葉節點之間以原作公式直接相加，略過粒子本身
+    void direct(int32_t t, int32_t s, FmmScratch* scratch) {
+        const Node* tn = &tree->nodes[t];
+        const Node* sn = &tree->nodes[s];
+        const int32_t* targets = &tree->order[tn->first];
+        const int32_t* sources = &tree->order[sn->first];
+        for (int i = 0; i < tn->count; i++) {
+            if (!isTarget(targets[i])) continue;
+            const BodyHot* body = &tree->bodies->hot[targets[i]];
+            double ax = 0.0, ay = 0.0;
+            for (int j = 0; j < sn->count; j++) {
+                if (sources[j] == targets[i]) continue;
+                pairAccel(body, &tree->bodies->hot[sources[j]], &ax, &ay);
+            }
+            scratch->acc_x[i] += ax;
+            scratch->acc_y[i] += ay;
+            scratch->cost[i] += sn->count;
+        }
+    }
+
+    // 把父節點的局部展開平移到子節點的質心 (L2L)
+    void localToLocal(int32_t parent, int32_t child) {
+        const Node* pn = &tree->nodes[parent];
+        const Node* cn = &tree->nodes[child];
+        double powers[(MAX_FMM_ORDER + 1) * (MAX_FMM_ORDER + 2) / 2];
+        monomials(fmm->order, cn->com[0] - pn->com[0], cn->com[1] - pn->com[1], powers);
+        const double* pl = &fmm->local[(size_t)parent * fmm->terms];
+        double* cl = &fmm->local[(size_t)child * fmm->terms];
+        for (int k = 0; k < fmm->terms; k++) {
+            cl[k] = 0.0;
+        }
+        for (const FmmTerm& t : fmm->shift) {
+            cl[t.in] += t.coef * pl[t.out] * powers[t.k];
+        }
+        fmm->inherited[child] = fmm->inherited[parent];
+    }
+
+    // 葉節點：在各粒子的位置對局部展開取梯度 (L2P)，加上直接相加的部分後寫出結果
+    void localToBodies(int32_t t, FmmScratch* scratch) {
+        const Node* tn = &tree->nodes[t];
+        const double* l = &fmm->local[(size_t)t * fmm->terms];
+        double powers[(MAX_FMM_ORDER + 1) * (MAX_FMM_ORDER + 2) / 2];
+        for (int i = 0; i < tn->count; i++) {
+            int32_t b = tree->order[tn->first + i];
+            if (!isTarget(b)) continue;
+            const BodyHot* body = &tree->bodies->hot[b];
+            monomials(fmm->order - 1, body->x - tn->com[0], body->y - tn->com[1], powers);
+            double gx = 0.0, gy = 0.0;
+            for (int n = 1; n <= fmm->order; n++) {
+                for (int bb = 0; bb <= n; bb++) {
+                    int aa = n - bb;
+                    double c = l[termIndex(aa, bb)];
+                    if (aa >= 1) gx += aa * c * powers[termIndex(aa - 1, bb)];
+                    if (bb >= 1) gy += bb * c * powers[termIndex(aa, bb - 1)];
+                }
+            }
+            // 與 compute_force_v2 相同由力推回加速度，各驅動程式不論用哪一個都得到相同結果
+            std::array<double, 2> f = {{G * (gx + scratch->acc_x[i]) * body->mass, G * (gy + scratch->acc_y[i]) * body->mass}};
+            BodyCold* cold = &tree->bodies->cold[b];
+            cold->a_x = f[0] / body->mass;
+            cold->a_y = f[1] / body->mass;
+            cold->cost = scratch->cost[i] + fmm->inherited[t];
+            forces[b - lo] = f;
+        }
+    }
+
+    // 處理目標節點 t 的來源清單。recurse 為 false 時不往下走，改把子節點與其來源清單放進 out
+    void process(int32_t t, const std::vector<int32_t>& sources, int depth, FmmScratch* scratch,
+                 bool recurse, std::vector<FmmTask>* out) {
+        const Node* tn = &tree->nodes[t];
+        std::vector<int32_t>* pending = &scratch->pending[depth];
+        pending->clear();
+        if (!tn->has_children) {
+            scratch->acc_x.assign(tn->count, 0.0);
+            scratch->acc_y.assign(tn->count, 0.0);
+            scratch->cost.assign(tn->count, 0);
+        }
+
+        int m2l_count = 0;
+        for (int32_t s : sources) {
+            interact(t, s, pending, scratch, &m2l_count);
+        }
+        fmm->inherited[t] += m2l_count;
+
+        if (!tn->has_children) {
+            localToBodies(t, scratch);
+            return;
+        }
+        for (int c = 0; c < 4; c++) {
+            int32_t child = tn->chd[c];
+            if (!fmm->needed[child]) continue;
+            localToLocal(t, child);
+            if (recurse) {
+                process(child, *pending, depth + 1, scratch, true, nullptr);
+            } else {
+                out->push_back({child, *pending});
+            }
+        }
+    }
+};
+
+} // namespace
+
+// 每個目標節點只依父節點留下的來源清單處理，不論從哪一層開始平行、[lo, hi) 為何，
+// 同一個節點收到的貢獻順序都相同，結果與執行緒數及 rank 數無關
+void computeForcesFmm(const options_t* opts, const Tree* tree, FmmTree* fmm, ThreadPool* pool,
+                      int lo, int hi, std::array<double, 2>* forces, const uint8_t* active) {
+    if (tree->n_nodes == 0) return;
+    FmmPass pass = {opts, tree, fmm, lo, hi, active, forces};
+
+    // 由下而上標記含有待計算粒子的節點
+    for (int32_t n = tree->n_nodes - 1; n >= 0; n--) {
+        const Node* node = &tree->nodes[n];
+        bool needed = false;
+        if (node->has_children) {
+            for (int c = 0; c < 4; c++) {
+                needed = needed || fmm->needed[node->chd[c]];
+            }
+        } else {
+            for (int i = 0; i < node->count && !needed; i++) {
+                needed = pass.isTarget(tree->order[node->first + i]);
+            }
+        }
+        fmm->needed[n] = needed;
+    }
+    if (!fmm->needed[0]) return;
+
+    // 先逐層展開到至少 FMM_TASKS 個目標節點 (或全部是葉節點)，再把各子樹交給執行緒池
+    for (int k = 0; k < fmm->terms; k++) {
+        fmm->local[k] = 0.0;
+    }
+    fmm->inherited[0] = 0;
+    FmmScratch top;
+    std::vector<FmmTask> tasks = {{0, {0}}};
+    bool expanded = true;
+    while ((int)tasks.size() < FMM_TASKS && expanded) {
+        expanded = false;
+        std::vector<FmmTask> next;
+        for (FmmTask& task : tasks) {
+            if (!tree->nodes[task.target].has_children) {
+                next.push_back(std::move(task));
+                continue;
+            }
+            pass.process(task.target, task.sources, 0, &top, false, &next);
+            expanded = true;
+        }
+        tasks.swap(next);
+    }
+
+    std::vector<FmmScratch> scratch(pool->size());
+    pool->parallel_for((int)tasks.size(), 1, [&](int begin, int end, int tid) {
+        for (int i = begin; i < end; i++) {
+            pass.process(tasks[i].target, tasks[i].sources, 0, &scratch[tid], true, nullptr);
+        }
+    });
+}
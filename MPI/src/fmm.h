@@ -0,0 +1,46 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "argparse.h"
+#include "common.h"
+#include "bodies.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+constexpr int FMM_TASKS = 64;       // 由上而下走訪到至少這麼多個目標節點後才交給執行緒池
+
+// 快速多極法 (FMM)。力的大小 ∝ 1/r²，對應的位勢是 1/r (而不是二維的 log r)，
+// 所以用 f(x, y) = (x² + y²)^(-1/2) 的笛卡兒泰勒展開，而不是複數多極展開。
+// 以質心為展開中心，係數依多重指標 (a, b)、a + b <= order 排列：
+//   多極矩  M_(a,b) = Σ m (x - cx)^a (y - cy)^b
+//   局部展開 φ(t) = Σ L_(a,b) (tx - zx)^a (ty - zy)^b，加速度 = G ∇φ
+
+// 平移與轉換用的係數表：out += coef * in * x[k]
+struct FmmTerm {
+    int32_t out, in, k;
+    double coef;
+};
+
+struct FmmTree {
+    int order = 0;
+    int terms = 0;                      // (order + 1)(order + 2) / 2
+    std::vector<FmmTerm> shift;         // M2M / L2L：x 為平移向量的單項式
+    std::vector<FmmTerm> m2l;           // M2L：x 為 f 在中心差上的泰勒係數
+    std::vector<double> multipole;      // 每個節點 terms 個係數
+    std::vector<double> local;
+    std::vector<double> radius;         // 子樹粒子到質心的最大距離
+    std::vector<int32_t> inherited;     // 祖先節點 (含自己) 做過的 M2L 次數，用來估計每個粒子的成本
+    std::vector<uint8_t> needed;        // 子樹內有需要計算的粒子
+};
+
+// 由下而上計算每個節點的多極矩 (P2M、M2M)
+void computeMultipoles(const options_t* opts, const Tree* tree, FmmTree* fmm);
+// 以雙樹走訪計算陣列索引落在 [lo, hi) 的粒子所受的力 (M2L、L2L、L2P 與葉節點間的直接相加)，
+// 結果存到 forces[b - lo]；給定 active 時只計算 active[b] 非 0 的粒子
+void computeForcesFmm(const options_t* opts, const Tree* tree, FmmTree* fmm, ThreadPool* pool,
+                      int lo, int hi, std::array<double, 2>* forces, const uint8_t* active);
+
+#endif // FMM_H
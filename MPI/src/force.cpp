@@ -0,0 +1,210 @@
+#include "force.h"
+#include <cmath>
+#include <cstdio>
+#include <mpi.h>
+#include "common.h"
+#include "domain.h"
+#include "quadrupole.h"
+
+// 開啟 --refit N 時只有每 N 步完整重建一次，其餘各步沿用上一步的樹並重算質心
+// direct 模式不建樹，只保留根節點供邊界檢查使用。
+// --domain adaptive 時根節點取粒子的外接正方形；沿用的樹包不住所有粒子時改為完整重建
+template <int D>
+void buildForceTree(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool, BodiesT<D>* bodies, int n,
+                    int step) {
+    TreeT<D>* tree = &engine->tree;
+    double box[2 * D];
+    bool adaptive = opts->domain == "adaptive";
+    if (adaptive) {
+        boundingBox(pool, bodies->hot.data(), n, box);
+    }
+    bool refit = opts->refit_every > 0 && step % opts->refit_every != 0 &&
+                 tree->n_nodes > 0 && tree->bodies == bodies && (!adaptive || rootContains(tree, box));
+    if (adaptive && !refit) {
+        setRootBox(tree, box);
+    }
+    if (opts->force_type == "direct") {
+        initialize_root(tree, bodies);
+        gatherDirectSources(tree_root(tree), bodies->hot.data(), n, &engine->direct);
+        return;
+    }
+    if (refit) {
+        refitTree(opts, tree);
+    } else {
+        buildTree(opts, tree, bodies, n);
+    }
+    prepareForceTree(opts, engine);
+}
+
+// 在已建好的 engine->tree 上建立 flat / group 模式需要的攤平樹與群組，或 fmm 模式的多極矩
+template <int D>
+void prepareForceTree(const options_t* opts, ForceEngineT<D>* engine) {
+    engine->prepared++;
+    if constexpr (D == 2) {
+        if (opts->quadrupole) {
+            computeQuadrupoles(&engine->tree);
+        } else {
+            engine->tree.quad.clear();
+        }
+    }
+    if (opts->force_type == "flat" || opts->force_type == "group") {
+        flattenTree(&engine->tree, &engine->flat, opts->precision == "mixed");
+    }
+    if (opts->force_type == "group") {
+        buildGroups(&engine->flat, opts->group_size, &engine->groups);
+    }
+    if constexpr (D == 2) {
+        if (opts->force_type == "fmm") {
+            computeMultipoles(opts, &engine->tree, &engine->fmm);
+        }
+    }
+}
+
+// 粒子移動後沿用現有的樹，只重新插入離開葉節點的粒子並重算質心
+template <int D>
+void refitForceTree(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool, int n) {
+    TreeT<D>* tree = &engine->tree;
+    if (opts->domain == "adaptive") {
+        double box[2 * D];
+        boundingBox(pool, tree->bodies->hot.data(), n, box);
+        if (!rootContains(tree, box)) {
+            buildForceTree(opts, engine, pool, tree->bodies, n, 0);
+            return;
+        }
+    }
+    if (opts->force_type == "direct") {
+        gatherDirectSources(tree_root(tree), tree->bodies->hot.data(), n, &engine->direct);
+        return;
+    }
+    refitTree(opts, tree);
+    prepareForceTree(opts, engine);
+}
+
+// 每步結束時釋放樹；refit 模式保留到下一步
+template <int D>
+void releaseForceTree(const options_t* opts, ForceEngineT<D>* engine) {
+    if (opts->refit_every == 0) {
+        tearDownTree(&engine->tree);
+    }
+}
+
+// flat / group 模式在攤平樹 flat 上計算 [lo, hi) 的力
+template <int D>
+static void computeFlatForces(const options_t* opts, ForceEngineT<D>* engine, const FlatTree* flat,
+                              const std::vector<int32_t>& groups, ThreadPool* pool, int lo, int hi,
+                              vec_t<D>* forces, const uint8_t* active) {
+    TreeT<D>* tree = &engine->tree;
+    BodiesT<D>* bodies = tree->bodies;
+    if (opts->force_type == "group") {
+        engine->lists.resize(pool->size());
+        pool->parallel_for((int)groups.size(), 1, [&](int begin, int end, int tid) {
+            for (int g = begin; g < end; ++g) {
+                computeGroupForces(opts, flat, groups[g], bodies, &engine->lists[tid], lo, hi, forces, active);
+            }
+        });
+        return;
+    }
+    const int32_t* order = tree->order.data();
+    pool->parallel_for((int)tree->order.size(), DEFAULT_CHUNK, [&](int begin, int end, int) {
+        for (int k = begin; k < end; ++k) {
+            int32_t b = order[k];
+            if (b < lo || b >= hi || (active && !active[b])) continue;
+            forces[b - lo] = compute_force_flat(opts, flat, bodies, b);
+        }
+    });
+}
+
+// 在同一棵樹上以 double 攤平樹重算 [lo, hi)，累加 mixed 結果的加速度相對誤差。
+// 比較完把 mixed 的加速度與交互作用次數放回去，模擬照常以 mixed 的結果進行 (只有二維)
+static void comparePrecision(const options_t* opts, ForceEngine* engine, ThreadPool* pool, int lo, int hi,
+                             const uint8_t* active) {
+    Bodies* bodies = engine->tree.bodies;
+    std::vector<BodyCold> mixed(bodies->cold.begin() + lo, bodies->cold.begin() + hi);
+    std::vector<std::array<double, 2>> forces(hi - lo);
+    FlatTree reference;
+    std::vector<int32_t> groups;
+    flattenTree(&engine->tree, &reference, false);
+    if (opts->force_type == "group") {
+        buildGroups(&reference, opts->group_size, &groups);
+    }
+    computeFlatForces(opts, engine, &reference, groups, pool, lo, hi, forces.data(), active);
+
+    for (int b = lo; b < hi; b++) {
+        BodyCold* cold = &bodies->cold[b];
+        const BodyCold* m = &mixed[b - lo];
+        bool compared = (!active || active[b]) && cold->index >= 0 && bodies->hot[b].mass != OUT_OF_BOUNDS_MASS;
+        double a = std::hypot(cold->a_x, cold->a_y);
+        if (compared && a > 0.0) {
+            double err = std::hypot(m->a_x - cold->a_x, m->a_y - cold->a_y) / a;
+            engine->precision_max = err > engine->precision_max ? err : engine->precision_max;
+            engine->precision_sum2 += err * err;
+            engine->precision_bodies++;
+        }
+        *cold = *m;
+    }
+}
+
+// 計算陣列索引落在 [lo, hi) 的粒子所受的力，結果存到 forces[b - lo]。
+// 給定 active 時只計算 active[b] 非 0 的粒子，其餘粒子的 forces 與加速度不變
+template <int D>
+void computeForces(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool,
+                   int lo, int hi, vec_t<D>* forces, const uint8_t* active) {
+    TreeT<D>* tree = &engine->tree;
+    BodiesT<D>* bodies = tree->bodies;
+
+    if (opts->force_type == "direct") {
+        computeForcesDirect(&engine->direct, pool, bodies, lo, hi, forces, active);
+        return;
+    }
+    if constexpr (D == 2) {
+        if (opts->force_type == "fmm") {
+            computeForcesFmm(opts, tree, &engine->fmm, pool, lo, hi, forces, active);
+            return;
+        }
+    }
+    if (opts->force_type == "flat" || opts->force_type == "group") {
+        computeFlatForces(opts, engine, &engine->flat, engine->groups, pool, lo, hi, forces, active);
+        // 只在第一棵樹 (初始位置) 上比較，額外成本為一次 double 的力計算
+        if constexpr (D == 2) {
+            if (engine->flat.mixed && engine->prepared == 1) {
+                comparePrecision(opts, engine, pool, lo, hi, active);
+            }
+        }
+        return;
+    }
+
+    const int32_t* order = tree->order.data();
+    pool->parallel_for((int)tree->order.size(), DEFAULT_CHUNK, [&](int begin, int end, int) {
+        for (int k = begin; k < end; ++k) {
+            int32_t b = order[k];
+            if (b < lo || b >= hi || (active && !active[b])) continue;
+            forces[b - lo] = compute_force_v2(opts, tree, b);
+        }
+    });
+}
+
+template <int D>
+void reportPrecision(const options_t* opts, const ForceEngineT<D>* engine, int rank) {
+    if (opts->precision != "mixed") return;
+
+    long long bodies = engine->precision_bodies;
+    double max_err = engine->precision_max, sum2 = engine->precision_sum2;
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &bodies, &bodies, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &max_err, &max_err, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &sum2, &sum2, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+    printf("mixed vs double (threshold %g, %lld bodies): max rel err %.3e, rms rel err %.3e\n", opts->threshold,
+           bodies, max_err, bodies > 0 ? std::sqrt(sum2 / bodies) : 0.0);
+}
+
+#define INSTANTIATE_FORCE(D)                                                                                       \
+    template void buildForceTree<D>(const options_t*, ForceEngineT<D>*, ThreadPool*, BodiesT<D>*, int, int);      \
+    template void prepareForceTree<D>(const options_t*, ForceEngineT<D>*);                                        \
+    template void refitForceTree<D>(const options_t*, ForceEngineT<D>*, ThreadPool*, int);                        \
+    template void releaseForceTree<D>(const options_t*, ForceEngineT<D>*);                                        \
+    template void computeForces<D>(const options_t*, ForceEngineT<D>*, ThreadPool*, int, int,                    \
+                                   vec_t<D>*, const uint8_t*);                                       \
+    template void reportPrecision<D>(const options_t*, const ForceEngineT<D>*, int);
+
+INSTANTIATE_FORCE(2)
+INSTANTIATE_FORCE(3)
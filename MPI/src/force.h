@@ -0,0 +1,51 @@
+#ifndef FORCE_H
+#define FORCE_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "argparse.h"
+#include "direct_force.h"
+#include "fmm.h"
+#include "flat_tree.h"
+#include "group_force.h"
+#include "bodies.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+// 各驅動程式 (BHSeq / parallel_mpi) 共用的樹與力計算狀態，依 opts->force_type 選擇實作。
+// 以維度 D 實體化：fmm、四極矩與 --precision mixed 只有 D = 2
+template <int D>
+struct ForceEngineT {
+    TreeT<D> tree;
+    FlatTree flat;                      // flat / group 模式使用
+    std::vector<int32_t> groups;        // group 模式的群組 (攤平樹的節點索引)
+    std::vector<InteractionList> lists; // 每個執行緒一份交互作用清單
+    DirectSources direct;               // direct 模式的來源陣列
+    FmmTree fmm;                        // fmm 模式的多極與局部展開
+    int prepared = 0;                   // prepareForceTree 的次數
+
+    // --precision mixed 的精度報告：第一棵樹上 mixed 與 double 走訪的加速度相對誤差
+    long long precision_bodies = 0;
+    double precision_max = 0.0, precision_sum2 = 0.0;
+};
+
+using ForceEngine = ForceEngineT<2>;
+
+template <int D>
+void buildForceTree(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool, BodiesT<D>* bodies, int n,
+                    int step);
+template <int D>
+void prepareForceTree(const options_t* opts, ForceEngineT<D>* engine);
+template <int D>
+void refitForceTree(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool, int n);
+template <int D>
+void releaseForceTree(const options_t* opts, ForceEngineT<D>* engine);
+template <int D>
+void computeForces(const options_t* opts, ForceEngineT<D>* engine, ThreadPool* pool,
+                   int lo, int hi, vec_t<D>* forces, const uint8_t* active = nullptr);
+// 彙整所有 rank 的精度報告並由 rank 0 印出；不是 --precision mixed 時不做事
+template <int D>
+void reportPrecision(const options_t* opts, const ForceEngineT<D>* engine, int rank);
+
+#endif // FORCE_H
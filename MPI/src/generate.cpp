@@ -0,0 +1,122 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "io.h"
+
+// 產生測試用的初始條件，輸出格式由副檔名決定 (文字或 .bhs)：
+//   ./bh_generate <uniform|plummer|galaxies|clustered> <N> <output> [seed]
+// 所有粒子都落在 [MIN_X, MAX_X] x [MIN_Y, MAX_Y] 內，質量在 [0.1, 1) 之間。
+
+static const double CENTER_X = (MIN_X + MAX_X) / 2;
+static const double CENTER_Y = (MIN_Y + MAX_Y) / 2;
+
+struct Generator {
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> unit{0.0, 1.0};
+    std::vector<particle> bodies;
+
+    double uniform(double lo, double hi) { return lo + (hi - lo) * unit(rng); }
+
+    bool inside(double x, double y) const { return x >= MIN_X && x <= MAX_X && y >= MIN_Y && y <= MAX_Y; }
+
+    void add(double x, double y, double mass, double vx, double vy) {
+        particle p;
+        p.index = (int)bodies.size();
+        p.x = x;
+        p.y = y;
+        p.mass = mass;
+        p.v_x = vx;
+        p.v_y = vy;
+        bodies.push_back(p);
+    }
+
+    // 投影後的 Plummer 分佈：面密度 ∝ (1 + R²/a²)^-2，累積質量 M(<R) = R² / (R² + a²)，
+    // 可直接反解 R = a * sqrt(u / (1 - u))。速度取該半徑的圓周速度 sqrt(G M(<R) / R)，逆時針旋轉，
+    // 再加上整體速度 (bvx, bvy)。超出領域的樣本重抽。
+    void plummer(int n, double cx, double cy, double a, double total_mass, double bvx, double bvy) {
+        int target = (int)bodies.size() + n;
+        while ((int)bodies.size() < target) {
+            double u = uniform(0.0, 0.99);
+            double r = a * std::sqrt(u / (1.0 - u));
+            double phi = uniform(0.0, 2.0 * M_PI);
+            double x = cx + r * std::cos(phi);
+            double y = cy + r * std::sin(phi);
+            if (!inside(x, y)) continue;
+            double enclosed = total_mass * r * r / (r * r + a * a);
+            double v = r > 0 ? std::sqrt(G * enclosed / std::max(r, RLIMIT)) : 0.0;
+            add(x, y, uniform(0.1, 1.0), bvx - v * std::sin(phi), bvy + v * std::cos(phi));
+        }
+    }
+
+    // 高度聚集：大部分粒子落在少數幾個高斯團塊裡，團塊本身的大小也差很多
+    void clustered(int n) {
+        int n_clusters = std::max(1, n / 2000);
+        std::vector<double> cx(n_clusters), cy(n_clusters), sigma(n_clusters);
+        for (int c = 0; c < n_clusters; c++) {
+            cx[c] = uniform(MIN_X + 0.5, MAX_X - 0.5);
+            cy[c] = uniform(MIN_Y + 0.5, MAX_Y - 0.5);
+            sigma[c] = 0.2 * std::pow(10.0, -uniform(0.0, 2.0));   // 0.002 ~ 0.2
+        }
+        std::normal_distribution<double> normal(0.0, 1.0);
+        while ((int)bodies.size() < n) {
+            double x, y;
+            if (unit(rng) < 0.1) {
+                x = uniform(MIN_X, MAX_X);
+                y = uniform(MIN_Y, MAX_Y);
+            } else {
+                int c = (int)(uniform(0.0, 1.0) * n_clusters) % n_clusters;
+                x = cx[c] + sigma[c] * normal(rng);
+                y = cy[c] + sigma[c] * normal(rng);
+            }
+            if (!inside(x, y)) continue;
+            add(x, y, uniform(0.1, 1.0), 0.0, 0.0);
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    if (argc < 4 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " <uniform|plummer|galaxies|clustered> <N> <output> [seed]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string dist = argv[1];
+    int n = atoi(argv[2]);
+    if (n <= 0) {
+        std::cerr << "Error: N must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Generator gen;
+    gen.rng.seed(argc == 5 ? strtoull(argv[4], nullptr, 10) : 1);
+    gen.bodies.reserve(n);
+
+    // 總質量約為 0.55 * N，用於估計圓周速度
+    if (dist == "uniform") {
+        while ((int)gen.bodies.size() < n) {
+            gen.add(gen.uniform(MIN_X, MAX_X), gen.uniform(MIN_Y, MAX_Y), gen.uniform(0.1, 1.0), 0.0, 0.0);
+        }
+    } else if (dist == "plummer") {
+        gen.plummer(n, CENTER_X, CENTER_Y, 0.3, 0.55 * n, 0.0, 0.0);
+    } else if (dist == "galaxies") {
+        // 兩個互相接近的星系，質量比 2:1
+        int n1 = 2 * n / 3;
+        gen.plummer(n1, CENTER_X - 0.8, CENTER_Y - 0.3, 0.2, 0.55 * n1, 0.05, 0.01);
+        gen.plummer(n - n1, CENTER_X + 0.8, CENTER_Y + 0.3, 0.15, 0.55 * (n - n1), -0.1, -0.02);
+    } else if (dist == "clustered") {
+        gen.clustered(n);
+    } else {
+        std::cerr << "Error: unknown distribution '" << dist << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    options_t opts;
+    opts.out_file = argv[3];
+    write_file(&opts, n, gen.bodies.data());
+    printf("%d %s bodies -> %s\n", n, dist.c_str(), argv[3]);
+    return EXIT_SUCCESS;
+}
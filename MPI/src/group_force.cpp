@@ -0,0 +1,414 @@
+#include "group_force.h"
+#include <cmath>
+#include "common.h"
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// 前序走訪攤平樹，粒子數不超過 group_size 的最高層子樹即為一個群組
+void buildGroups(const FlatTree* flat, int group_size, std::vector<int32_t>* groups) {
+    groups->clear();
+    int32_t k = 0;
+    while (k < flat->n) {
+        if (flat->count[k] <= group_size) {
+            groups->push_back(k);
+            k = flat->skip[k];
+        } else {
+            k++;
+        }
+    }
+}
+
+// mixed 攤平樹的清單：MAC 在 origin 座標下以 float 計算，項目改存相對於群組中心的 float。
+// 單一粒子的項目直接由粒子的 double 位置換算，近距離的交互作用不受節點 float 捨入影響
+static void buildInteractionListMixed(const options_t* opts, const FlatTree* flat, const double box[4],
+                                      const BodyHot* bodies, InteractionList* list) {
+    const float* com_x = flat->com_xf.data();
+    const float* com_y = flat->com_yf.data();
+    const float* size2 = flat->size2_f.data();
+    const double ox = flat->origin[0], oy = flat->origin[1];
+    const float fbox[4] = {(float)(box[0] - ox), (float)(box[1] - oy), (float)(box[2] - ox), (float)(box[3] - oy)};
+    const float theta2 = (float)(opts->threshold * opts->threshold);
+
+    list->mixed = true;
+    list->cx = 0.5 * (box[0] + box[2]);
+    list->cy = 0.5 * (box[1] + box[3]);
+    list->n = 0;
+    int32_t k = 0;
+    while (k < flat->n) {
+        if (size2[k] >= theta2 * boxDistance2(com_x[k], com_y[k], fbox)) {
+            k++; // 打開節點
+            continue;
+        }
+        if ((size_t)list->n >= list->xf.size()) {
+            size_t cap = list->xf.size() < 256 ? 256 : list->xf.size() * 2;
+            list->xf.resize(cap);
+            list->yf.resize(cap);
+            list->gmf.resize(cap);
+        }
+        if (size2[k] < 0) {
+            const BodyHot* p = &bodies[flat->bodies[flat->first[k]]];
+            list->xf[list->n] = (float)(p->x - list->cx);
+            list->yf[list->n] = (float)(p->y - list->cy);
+            list->gmf[list->n] = (float)(G * p->mass);
+        } else {
+            list->xf[list->n] = (float)(ox + com_x[k] - list->cx);
+            list->yf[list->n] = (float)(oy + com_y[k] - list->cy);
+            list->gmf[list->n] = (float)(G * flat->mass_f[k]);
+        }
+        list->n++;
+        k = flat->skip[k];
+    }
+
+    int padded = (list->n + SIMD_PAD_MIXED - 1) / SIMD_PAD_MIXED * SIMD_PAD_MIXED;
+    if ((size_t)padded > list->xf.size()) {
+        list->xf.resize(padded);
+        list->yf.resize(padded);
+        list->gmf.resize(padded);
+    }
+    for (int j = list->n; j < padded; ++j) {
+        list->xf[j] = list->yf[j] = 0.0f;
+        list->gmf[j] = 0.0f;
+    }
+}
+
+// 群組層級的 MAC：以節點質心到群組外接矩形的最短距離判斷，
+// 對群組內每個粒子都成立，所以整個群組可以共用同一份清單
+template <int D>
+void buildInteractionList(const options_t* opts, const FlatTree* flat, int32_t group,
+                          const BodyHotT<D>* bodies, InteractionList* list) {
+    const int32_t* members = &flat->bodies[flat->first[group]];
+    int n_members = flat->count[group];
+
+    double box[2 * D];
+    for (int k = 0; k < D; k++) {
+        box[k] = box[D + k] = bodies[members[0]].pos(k);
+    }
+    for (int i = 1; i < n_members; ++i) {
+        const BodyHotT<D>* b = &bodies[members[i]];
+        for (int k = 0; k < D; k++) {
+            box[k] = b->pos(k) < box[k] ? b->pos(k) : box[k];
+            box[D + k] = b->pos(k) > box[D + k] ? b->pos(k) : box[D + k];
+        }
+    }
+    if constexpr (D == 2) {
+        if (flat->mixed) {
+            buildInteractionListMixed(opts, flat, box, bodies, list);
+            return;
+        }
+    }
+
+    const double* com_x = flat->com_x.data();
+    const double* com_y = flat->com_y.data();
+    const double* com_z = flat->com_z.data();
+    const double* size2 = flat->size2.data();
+    const double theta2 = opts->threshold * opts->threshold;
+
+    list->mixed = false;
+    list->n = 0;
+    int32_t k = 0;
+    while (k < flat->n) {
+        double dist2;
+        if constexpr (D == 3) {
+            dist2 = boxDistance2(com_x[k], com_y[k], com_z[k], box);
+        } else {
+            dist2 = boxDistance2(com_x[k], com_y[k], box);
+        }
+        if (size2[k] >= theta2 * dist2) {
+            k++; // 打開節點
+            continue;
+        }
+        if ((size_t)list->n >= list->x.size()) {
+            size_t cap = list->x.size() < 256 ? 256 : list->x.size() * 2;
+            list->x.resize(cap);
+            list->y.resize(cap);
+            if (D == 3) list->z.resize(cap);
+            list->gm.resize(cap);
+        }
+        list->x[list->n] = com_x[k];
+        list->y[list->n] = com_y[k];
+        if constexpr (D == 3) {
+            list->z[list->n] = com_z[k];
+        }
+        list->gm[list->n] = G * flat->mass[k];
+        list->n++;
+        k = flat->skip[k];
+    }
+
+    // 補齊到 SIMD 寬度
+    int padded = (list->n + SIMD_PAD - 1) / SIMD_PAD * SIMD_PAD;
+    if ((size_t)padded > list->x.size()) {
+        list->x.resize(padded);
+        list->y.resize(padded);
+        if (D == 3) list->z.resize(padded);
+        list->gm.resize(padded);
+    }
+    for (int j = list->n; j < padded; ++j) {
+        list->x[j] = list->y[j] = 0.0;
+        if (D == 3) list->z[j] = 0.0;
+        list->gm[j] = 0.0;
+    }
+}
+
+// 一個粒子對整份清單的加速度
+void evaluateInteractions(const InteractionList* list, double x, double y, double* ax, double* ay) {
+    if (list->mixed) {
+        accumulateInteractionsMixed(list->xf.data(), list->yf.data(), list->gmf.data(), list->n,
+                                    (float)(x - list->cx), (float)(y - list->cy), ax, ay);
+        return;
+    }
+    accumulateInteractions(list->x.data(), list->y.data(), list->gm.data(), list->n, x, y, ax, ay);
+}
+
+void evaluateInteractions(const InteractionList* list, double x, double y, double z,
+                          double* ax, double* ay, double* az) {
+    accumulateInteractions(list->x.data(), list->y.data(), list->z.data(), list->gm.data(), list->n,
+                           x, y, z, ax, ay, az);
+}
+
+// 一個粒子對 n 個來源 (SoA) 的加速度。距離為 0 的項目 (粒子本身) 以遮罩排除。
+void accumulateInteractions(const double* lx, const double* ly, const double* gm, int n,
+                            double x, double y, double* ax, double* ay) {
+#if defined(__AVX512F__)
+    const __m512d vx = _mm512_set1_pd(x), vy = _mm512_set1_pd(y);
+    const __m512d rl = _mm512_set1_pd(RLIMIT), zero = _mm512_setzero_pd();
+    __m512d acc_x = zero, acc_y = zero;
+    for (int j = 0; j < n; j += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(lx + j), vx);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(ly + j), vy);
+        __m512d d2 = _mm512_fmadd_pd(dx, dx, _mm512_mul_pd(dy, dy));
+        __mmask8 m = _mm512_cmp_pd_mask(d2, zero, _CMP_GT_OQ);
+        __m512d d = _mm512_sqrt_pd(d2);
+        __m512d r = _mm512_max_pd(d, rl);
+        __m512d s = _mm512_maskz_div_pd(m, _mm512_loadu_pd(gm + j), _mm512_mul_pd(d, _mm512_mul_pd(r, r)));
+        acc_x = _mm512_fmadd_pd(s, dx, acc_x);
+        acc_y = _mm512_fmadd_pd(s, dy, acc_y);
+    }
+    *ax = _mm512_reduce_add_pd(acc_x);
+    *ay = _mm512_reduce_add_pd(acc_y);
+#elif defined(__AVX__)
+    const __m256d vx = _mm256_set1_pd(x), vy = _mm256_set1_pd(y);
+    const __m256d rl = _mm256_set1_pd(RLIMIT), zero = _mm256_setzero_pd();
+    __m256d acc_x = zero, acc_y = zero;
+    for (int j = 0; j < n; j += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(lx + j), vx);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ly + j), vy);
+        __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        __m256d m = _mm256_cmp_pd(d2, zero, _CMP_GT_OQ);
+        __m256d d = _mm256_sqrt_pd(d2);
+        __m256d r = _mm256_max_pd(d, rl);
+        __m256d s = _mm256_div_pd(_mm256_loadu_pd(gm + j), _mm256_mul_pd(d, _mm256_mul_pd(r, r)));
+        s = _mm256_and_pd(s, m);
+        acc_x = _mm256_add_pd(acc_x, _mm256_mul_pd(s, dx));
+        acc_y = _mm256_add_pd(acc_y, _mm256_mul_pd(s, dy));
+    }
+    double bx[4], by[4];
+    _mm256_storeu_pd(bx, acc_x);
+    _mm256_storeu_pd(by, acc_y);
+    *ax = (bx[0] + bx[1]) + (bx[2] + bx[3]);
+    *ay = (by[0] + by[1]) + (by[2] + by[3]);
+#else
+    double sx = 0.0, sy = 0.0;
+    for (int j = 0; j < n; ++j) {
+        double dx = lx[j] - x;
+        double dy = ly[j] - y;
+        double d2 = dx * dx + dy * dy;
+        if (d2 > 0.0) {
+            double d = sqrt(d2);
+            double r = d >= RLIMIT ? d : RLIMIT;
+            double s = gm[j] / (d * r * r);
+            sx += s * dx;
+            sy += s * dy;
+        }
+    }
+    *ax = sx;
+    *ay = sy;
+#endif
+}
+
+// 三維核心：與二維版本相同的遮罩與截斷，每一項多一個 z 分量。
+// 二維與三維各自是獨立的函式，維度在編譯期決定，二維的核心不受影響
+void accumulateInteractions(const double* lx, const double* ly, const double* lz, const double* gm, int n,
+                            double x, double y, double z, double* ax, double* ay, double* az) {
+#if defined(__AVX512F__)
+    const __m512d vx = _mm512_set1_pd(x), vy = _mm512_set1_pd(y), vz = _mm512_set1_pd(z);
+    const __m512d rl = _mm512_set1_pd(RLIMIT), zero = _mm512_setzero_pd();
+    __m512d acc_x = zero, acc_y = zero, acc_z = zero;
+    for (int j = 0; j < n; j += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(lx + j), vx);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(ly + j), vy);
+        __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(lz + j), vz);
+        __m512d d2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+        __mmask8 m = _mm512_cmp_pd_mask(d2, zero, _CMP_GT_OQ);
+        __m512d d = _mm512_sqrt_pd(d2);
+        __m512d r = _mm512_max_pd(d, rl);
+        __m512d s = _mm512_maskz_div_pd(m, _mm512_loadu_pd(gm + j), _mm512_mul_pd(d, _mm512_mul_pd(r, r)));
+        acc_x = _mm512_fmadd_pd(s, dx, acc_x);
+        acc_y = _mm512_fmadd_pd(s, dy, acc_y);
+        acc_z = _mm512_fmadd_pd(s, dz, acc_z);
+    }
+    *ax = _mm512_reduce_add_pd(acc_x);
+    *ay = _mm512_reduce_add_pd(acc_y);
+    *az = _mm512_reduce_add_pd(acc_z);
+#elif defined(__AVX__)
+    const __m256d vx = _mm256_set1_pd(x), vy = _mm256_set1_pd(y), vz = _mm256_set1_pd(z);
+    const __m256d rl = _mm256_set1_pd(RLIMIT), zero = _mm256_setzero_pd();
+    __m256d acc_x = zero, acc_y = zero, acc_z = zero;
+    for (int j = 0; j < n; j += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(lx + j), vx);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ly + j), vy);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(lz + j), vz);
+        __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                                   _mm256_mul_pd(dz, dz));
+        __m256d m = _mm256_cmp_pd(d2, zero, _CMP_GT_OQ);
+        __m256d d = _mm256_sqrt_pd(d2);
+        __m256d r = _mm256_max_pd(d, rl);
+        __m256d s = _mm256_div_pd(_mm256_loadu_pd(gm + j), _mm256_mul_pd(d, _mm256_mul_pd(r, r)));
+        s = _mm256_and_pd(s, m);
+        acc_x = _mm256_add_pd(acc_x, _mm256_mul_pd(s, dx));
+        acc_y = _mm256_add_pd(acc_y, _mm256_mul_pd(s, dy));
+        acc_z = _mm256_add_pd(acc_z, _mm256_mul_pd(s, dz));
+    }
+    double bx[4], by[4], bz[4];
+    _mm256_storeu_pd(bx, acc_x);
+    _mm256_storeu_pd(by, acc_y);
+    _mm256_storeu_pd(bz, acc_z);
+    *ax = (bx[0] + bx[1]) + (bx[2] + bx[3]);
+    *ay = (by[0] + by[1]) + (by[2] + by[3]);
+    *az = (bz[0] + bz[1]) + (bz[2] + bz[3]);
+#else
+    double sx = 0.0, sy = 0.0, sz = 0.0;
+    for (int j = 0; j < n; ++j) {
+        double dx = lx[j] - x;
+        double dy = ly[j] - y;
+        double dz = lz[j] - z;
+        double d2 = dx * dx + dy * dy + dz * dz;
+        if (d2 > 0.0) {
+            double d = sqrt(d2);
+            double r = d >= RLIMIT ? d : RLIMIT;
+            double s = gm[j] / (d * r * r);
+            sx += s * dx;
+            sy += s * dy;
+            sz += s * dz;
+        }
+    }
+    *ax = sx;
+    *ay = sy;
+    *az = sz;
+#endif
+}
+
+// accumulateInteractions 的 float 版本：同樣寬度的向量一次處理兩倍的項目，
+// 每一項的加速度轉成 double 後才累加，長清單的加總不會累積 float 的捨入誤差
+void accumulateInteractionsMixed(const float* lx, const float* ly, const float* gm, int n,
+                                 float x, float y, double* ax, double* ay) {
+#if defined(__AVX512F__)
+    const __m512 vx = _mm512_set1_ps(x), vy = _mm512_set1_ps(y);
+    const __m512 rl = _mm512_set1_ps((float)RLIMIT), zero = _mm512_setzero_ps();
+    __m512d acc_x = _mm512_setzero_pd(), acc_y = _mm512_setzero_pd();
+    for (int j = 0; j < n; j += 16) {
+        __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(lx + j), vx);
+        __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(ly + j), vy);
+        __m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+        __mmask16 m = _mm512_cmp_ps_mask(d2, zero, _CMP_GT_OQ);
+        __m512 d = _mm512_sqrt_ps(d2);
+        __m512 r = _mm512_max_ps(d, rl);
+        __m512 s = _mm512_maskz_div_ps(m, _mm512_loadu_ps(gm + j), _mm512_mul_ps(d, _mm512_mul_ps(r, r)));
+        __m512 tx = _mm512_mul_ps(s, dx);
+        __m512 ty = _mm512_mul_ps(s, dy);
+        acc_x = _mm512_add_pd(acc_x, _mm512_cvtps_pd(_mm512_castps512_ps256(tx)));
+        acc_y = _mm512_add_pd(acc_y, _mm512_cvtps_pd(_mm512_castps512_ps256(ty)));
+        acc_x = _mm512_add_pd(acc_x, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(tx), 1))));
+        acc_y = _mm512_add_pd(acc_y, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(ty), 1))));
+    }
+    *ax = _mm512_reduce_add_pd(acc_x);
+    *ay = _mm512_reduce_add_pd(acc_y);
+#elif defined(__AVX__)
+    const __m256 vx = _mm256_set1_ps(x), vy = _mm256_set1_ps(y);
+    const __m256 rl = _mm256_set1_ps((float)RLIMIT), zero = _mm256_setzero_ps();
+    __m256d acc_x = _mm256_setzero_pd(), acc_y = _mm256_setzero_pd();
+    for (int j = 0; j < n; j += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(lx + j), vx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ly + j), vy);
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        __m256 m = _mm256_cmp_ps(d2, zero, _CMP_GT_OQ);
+        __m256 d = _mm256_sqrt_ps(d2);
+        __m256 r = _mm256_max_ps(d, rl);
+        __m256 s = _mm256_div_ps(_mm256_loadu_ps(gm + j), _mm256_mul_ps(d, _mm256_mul_ps(r, r)));
+        s = _mm256_and_ps(s, m);
+        __m256 tx = _mm256_mul_ps(s, dx);
+        __m256 ty = _mm256_mul_ps(s, dy);
+        acc_x = _mm256_add_pd(acc_x, _mm256_cvtps_pd(_mm256_castps256_ps128(tx)));
+        acc_y = _mm256_add_pd(acc_y, _mm256_cvtps_pd(_mm256_castps256_ps128(ty)));
+        acc_x = _mm256_add_pd(acc_x, _mm256_cvtps_pd(_mm256_extractf128_ps(tx, 1)));
+        acc_y = _mm256_add_pd(acc_y, _mm256_cvtps_pd(_mm256_extractf128_ps(ty, 1)));
+    }
+    double bx[4], by[4];
+    _mm256_storeu_pd(bx, acc_x);
+    _mm256_storeu_pd(by, acc_y);
+    *ax = (bx[0] + bx[1]) + (bx[2] + bx[3]);
+    *ay = (by[0] + by[1]) + (by[2] + by[3]);
+#else
+    const float rlimit = (float)RLIMIT;
+    double sx = 0.0, sy = 0.0;
+    for (int j = 0; j < n; ++j) {
+        float dx = lx[j] - x;
+        float dy = ly[j] - y;
+        float d2 = dx * dx + dy * dy;
+        if (d2 > 0.0f) {
+            float d = std::sqrt(d2);
+            float r = d >= rlimit ? d : rlimit;
+            float s = gm[j] / (d * r * r);
+            sx += (double)(s * dx);
+            sy += (double)(s * dy);
+        }
+    }
+    *ax = sx;
+    *ay = sy;
+#endif
+}
+
+// 計算群組內陣列索引落在 [lo, hi) 的粒子 (給定 active 時只算 active[b] 非 0 者) 所受的力，
+// 結果存到 forces[b - lo]；沒有要算的成員時不建清單
+template <int D>
+void computeGroupForces(const options_t* opts, const FlatTree* flat, int32_t group, BodiesT<D>* bodies,
+                        InteractionList* list, int lo, int hi, vec_t<D>* forces,
+                        const uint8_t* active) {
+    const int32_t* members = &flat->bodies[flat->first[group]];
+    int n_members = flat->count[group];
+
+    bool any = false;
+    for (int i = 0; i < n_members; ++i) {
+        any |= members[i] >= lo && members[i] < hi && (!active || active[members[i]]);
+    }
+    if (!any) return;
+
+    buildInteractionList(opts, flat, group, bodies->hot.data(), list);
+
+    for (int i = 0; i < n_members; ++i) {
+        int32_t b = members[i];
+        if (b < lo || b >= hi || (active && !active[b])) continue;
+        const BodyHotT<D>* body = &bodies->hot[b];
+        BodyColdT<D>* cold = &bodies->cold[b];
+        double a[D];
+        if constexpr (D == 3) {
+            evaluateInteractions(list, body->x, body->y, body->z, &a[0], &a[1], &a[2]);
+        } else {
+            evaluateInteractions(list, body->x, body->y, &a[0], &a[1]);
+        }
+        cold->cost = list->n;
+        for (int k = 0; k < D; k++) {
+            cold->acc(k) = a[k];
+            forces[b - lo][k] = a[k] * body->mass;
+        }
+    }
+}
+
+#define INSTANTIATE_GROUP(D)                                                                              \
+    template void buildInteractionList<D>(const options_t*, const FlatTree*, int32_t, const BodyHotT<D>*,  \
+                                          InteractionList*);                                              \
+    template void computeGroupForces<D>(const options_t*, const FlatTree*, int32_t, BodiesT<D>*,          \
+                                        InteractionList*, int, int, vec_t<D>*, const uint8_t*);
+
+INSTANTIATE_GROUP(2)
+INSTANTIATE_GROUP(3)
@@ -0,0 +1,46 @@
+#ifndef GROUP_FORCE_H
+#define GROUP_FORCE_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "argparse.h"
+#include "flat_tree.h"
+#include "bodies.h"
+
+constexpr int SIMD_PAD = 8;         // 清單長度補齊到 8 個 double (一個 AVX-512 向量)
+constexpr int SIMD_PAD_MIXED = 16;  // mixed 清單補齊到 16 個 float
+
+// 一個粒子群組共用的交互作用清單 (SoA)，長度會補齊到 SIMD 寬度的倍數。
+// gm 直接存 G * mass，補齊的項目 gm = 0。每個執行緒各用一份。
+// 攤平樹為 mixed 時改用 float 的 xf / yf / gmf，位置相對於群組外接矩形的中心 (cx, cy)。z 只有三維時使用
+struct InteractionList {
+    std::vector<double> x, y, z, gm;
+    std::vector<float> xf, yf, gmf;
+    double cx = 0.0, cy = 0.0;
+    bool mixed = false;
+    int n = 0;
+};
+
+void buildGroups(const FlatTree* flat, int group_size, std::vector<int32_t>* groups);
+template <int D>
+void buildInteractionList(const options_t* opts, const FlatTree* flat, int32_t group,
+                          const BodyHotT<D>* bodies, InteractionList* list);
+void evaluateInteractions(const InteractionList* list, double x, double y, double* ax, double* ay);
+void evaluateInteractions(const InteractionList* list, double x, double y, double z,
+                          double* ax, double* ay, double* az);
+// 向量化核心：來源陣列從 lx / ly / gm 開始，n 必須是 SIMD_PAD 的倍數 (補齊項 gm = 0)
+void accumulateInteractions(const double* lx, const double* ly, const double* gm, int n,
+                            double x, double y, double* ax, double* ay);
+// 三維版本：多一個 lz 來源陣列，其餘相同
+void accumulateInteractions(const double* lx, const double* ly, const double* lz, const double* gm, int n,
+                            double x, double y, double z, double* ax, double* ay, double* az);
+// float 版本：n 必須是 SIMD_PAD_MIXED 的倍數，每一項以 float 計算後以 double 累加
+void accumulateInteractionsMixed(const float* lx, const float* ly, const float* gm, int n,
+                                 float x, float y, double* ax, double* ay);
+template <int D>
+void computeGroupForces(const options_t* opts, const FlatTree* flat, int32_t group, BodiesT<D>* bodies,
+                        InteractionList* list, int lo, int hi, vec_t<D>* forces,
+                        const uint8_t* active);
+
+#endif // GROUP_FORCE_H
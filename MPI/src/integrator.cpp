@@ -0,0 +1,85 @@
+#include "integrator.h"
+#include <cmath>
+#include "checkpoint.h"
+#include "common.h"
+
+// Yoshida (1990) 四階組合的係數：w1 = 1 / (2 - 2^(1/3))，w0 = 1 - 2 w1
+static const double YOSHIDA_W1 = 1.0 / (2.0 - std::cbrt(2.0));
+static const double YOSHIDA_W0 = 1.0 - 2.0 * YOSHIDA_W1;
+
+int substepsPerStep(const options_t* opts) {
+    return opts->integrator == "yoshida4" ? 3 : 1;
+}
+
+int firstIteration(const options_t* opts) {
+    return restartStep(opts) * substepsPerStep(opts);
+}
+
+int endIteration(const options_t* opts) {
+    int n = opts->n_steps * substepsPerStep(opts);
+    return opts->integrator == "euler" ? n : n + 1;
+}
+
+int completedStep(const options_t* opts, int iteration) {
+    int k = substepsPerStep(opts);
+    if (iteration >= opts->n_steps * k || (iteration + 1) % k != 0) {
+        return 0;
+    }
+    return (iteration + 1) / k;
+}
+
+// 第 iteration 個子步的 drift 係數，超出範圍 (第一輪之前與收尾輪) 為 0
+static double driftCoefficient(const options_t* opts, int iteration) {
+    int k = substepsPerStep(opts);
+    if (iteration < 0 || iteration >= opts->n_steps * k) {
+        return 0.0;
+    }
+    if (k == 1) {
+        return 1.0;
+    }
+    return iteration % k == 1 ? YOSHIDA_W0 : YOSHIDA_W1;
+}
+
+template <int D>
+void advanceBody(const options_t* opts, BodyHotT<D>* body, BodyColdT<D>* cold, const double* accel, int iteration,
+                 const NodeT<D>* root) {
+    // 超出邊界的粒子停在離開時的狀態
+    if (body->mass == OUT_OF_BOUNDS_MASS) {
+        return;
+    }
+    double dt = opts->timestep;
+    if (opts->integrator == "euler") {
+        // 與原本 updateParticleState_v2 相同的運算式；-march=native 下編譯器會把它縮成 FMA，
+        // 改寫運算順序 (例如分成兩個迴圈) 會讓結果在最後一位與原版不同
+        for (int k = 0; k < D; k++) {
+            body->pos(k) += cold->vel(k) * dt + 0.5 * accel[k] * dt * dt;
+            cold->vel(k) += accel[k] * dt;
+        }
+    } else {
+        // 上一子步收尾的半個 kick 與這一子步開頭的半個 kick 合併
+        double drift = driftCoefficient(opts, iteration);
+        double kick = 0.5 * (driftCoefficient(opts, iteration - 1) + drift) * dt;
+        for (int k = 0; k < D; k++) {
+            cold->vel(k) += accel[k] * kick;
+            body->pos(k) += cold->vel(k) * drift * dt;
+        }
+    }
+    // 自適應領域下一步的根節點會包住所有粒子，不會有粒子超出邊界
+    if (opts->domain == "fixed" && !contains(root, body)) {
+        body->mass = OUT_OF_BOUNDS_MASS;
+    }
+}
+
+template <int D>
+void advanceBody(const options_t* opts, BodyHotT<D>* body, BodyColdT<D>* cold, int iteration, const NodeT<D>* root) {
+    double accel[D];
+    for (int k = 0; k < D; k++) {
+        accel[k] = cold->acc(k);
+    }
+    advanceBody(opts, body, cold, accel, iteration, root);
+}
+
+template void advanceBody<2>(const options_t*, BodyHot*, BodyCold*, const double*, int, const Node*);
+template void advanceBody<3>(const options_t*, BodyHotT<3>*, BodyColdT<3>*, const double*, int, const NodeT<3>*);
+template void advanceBody<2>(const options_t*, BodyHot*, BodyCold*, int, const Node*);
+template void advanceBody<3>(const options_t*, BodyHotT<3>*, BodyColdT<3>*, int, const NodeT<3>*);
@@ -0,0 +1,32 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "argparse.h"
+#include "bodies.h"
+#include "tree.h"
+
+// 時間積分方法 (--integrator)：
+//   euler (預設)：原本的更新 x += v dt + a dt² / 2、v += a dt，每步一次力計算。
+//   leapfrog：KDK 蛙跳法，每步一次力計算。
+//   yoshida4：Yoshida 四階辛積分，每步由係數 w1、w0、w1 的三個蛙跳子步組成，每步三次力計算。
+// 辛積分的每個子步為 kick(c/2)、drift(c)、kick(c/2)。前一子步收尾的 kick 與下一子步開頭的 kick
+// 用的是同一個位置的力，因此合併成時間步迴圈的一輪：建樹、算力、kick、drift、交換。
+// 迴圈最後多跑一輪只做收尾的 kick，讓輸出的速度與位置同步。
+// 檢查點寫在兩輪之間，存的是開頭 kick 之後的速度；從檢查點繼續時要用相同的 --integrator。
+
+// 每步的子步數
+int substepsPerStep(const options_t* opts);
+// 時間步迴圈的第一輪與結束值 (不含)，從檢查點繼續時由檢查點的步數開始
+int firstIteration(const options_t* opts);
+int endIteration(const options_t* opts);
+// 第 iteration 輪結束時完成的步數；不在步的邊界 (或為收尾輪) 時回傳 0
+int completedStep(const options_t* opts, int iteration);
+// 以粒子目前位置的加速度 accel[0, D) 推進第 iteration 輪，固定領域下離開 root 的粒子標記為出界
+template <int D>
+void advanceBody(const options_t* opts, BodyHotT<D>* body, BodyColdT<D>* cold, const double* accel, int iteration,
+                 const NodeT<D>* root);
+// 同上，使用力計算時存在 cold 的加速度 (MPI 版本)
+template <int D>
+void advanceBody(const options_t* opts, BodyHotT<D>* body, BodyColdT<D>* cold, int iteration, const NodeT<D>* root);
+
+#endif // INTEGRATOR_H
@@ -5,14 +5,26 @@
 #include <cstring>
 #include <fstream>
 #include <climits>  // 定義 INT_MAX
+#include "snapshot.h"
 
-void read_file_parallel(struct options_t* opts, struct particle **bodies, int num_procs) {
-    // 打開輸入文件
+// 二維 (particle) 與三維 (particle3) 共用；三維時每行多了 z 與 v_z
+template <typename P>
+static void readFileParallel(struct options_t* opts, P **bodies, int num_procs) {
+    constexpr int D = dims_of<P>::value;
+    // 打開輸入文件；.bhs 為二進位快照，直接 mmap
+    const bool binary = isSnapshotPath(opts->in_file);
+    Snapshot snap;
     std::ifstream in;
-    in.open(opts->in_file);
+    if (binary) {
+        openSnapshot(opts->in_file, &snap);
+        checkSnapshotDims(&snap.header, D, opts->in_file);
+        opts->n_particles = (int)snap.header.n;
+    } else {
+        in.open(opts->in_file);
 
-    // 獲取粒子數量
-    in >> opts->n_particles;
+        // 獲取粒子數量
+        in >> opts->n_particles;
+    }
 
     if ((opts->n_particles) <= 0 || (opts->n_particles) > INT_MAX) {
         std::cerr << "Invalid number of inputs in input file" << std::endl;
@@ -29,38 +41,75 @@ void read_file_parallel(struct options_t* opts, struct particle **bodies, int nu
     opts->n_bodiesParallel = totalBodies;
 
     // 分配內存
-    int bodySize = opts->n_bodiesParallel * sizeof(struct particle);
-    *bodies = (struct particle *)malloc(bodySize);
+    int bodySize = opts->n_bodiesParallel * sizeof(P);
+    *bodies = (P *)malloc(bodySize);
     memset((char *)(*bodies), 0, bodySize);
 
     // 設置邊界條件
-    double min[2], max[2];
-    min[0] = min[1] = 0;
-    max[0] = max[1] = 4;
+    double min[D], max[D];
+    for (int k = 0; k < D; k++) {
+        min[k] = 0;
+        max[k] = 4;
+    }
 
     // 讀取粒子數據
+    if (binary) {
+        copySnapshot(&snap, 0, opts->n_particles, *bodies);
+        closeSnapshot(&snap);
+    }
     for (int i = 0; i < opts->n_particles; ++i) {
-        struct particle *b = &((*bodies)[i]);
-        in >> b->index;
-        in >> b->x;
-        in >> b->y;
-        in >> b->mass;
-        in >> b->v_x;
-        in >> b->v_y;
+        P *b = &((*bodies)[i]);
+        if (!binary) {
+            in >> b->index;
+            in >> b->x;
+            in >> b->y;
+            if constexpr (D == 3) {
+                in >> b->z;
+            }
+            in >> b->mass;
+            in >> b->v_x;
+            in >> b->v_y;
+            if constexpr (D == 3) {
+                in >> b->v_z;
+            }
+        }
+        // 自適應領域的根節點會包住所有粒子，不需標記
+        if (opts->domain != "fixed")
+            continue;
         if (b->x < min[0] || b->y < min[1])
             b->mass = -1;
         if (b->x > max[0] || b->y > max[1])
             b->mass = -1;
+        if constexpr (D == 3) {
+            if (b->z < min[2] || b->z > max[2])
+                b->mass = -1;
+        }
     }
 
     // 填充剩餘粒子數據（用於並行對齊）
     for (int i = opts->n_particles; i < opts->n_bodiesParallel; i++) {
-        struct particle *b = &((*bodies)[i]);
+        P *b = &((*bodies)[i]);
         b->index = -10;
     }
 }
 
+void read_file_parallel(struct options_t* opts, struct particle **bodies, int num_procs) {
+    readFileParallel(opts, bodies, num_procs);
+}
+
+void read_file_parallel(struct options_t* opts, struct particle3 **bodies, int num_procs) {
+    readFileParallel(opts, bodies, num_procs);
+}
+
 void write_file_parallel(struct options_t* opts, struct particle *bodies) {
+    if (isSnapshotPath(opts->out_file)) {
+        if (!writeSnapshot(opts->out_file, bodies, opts->n_particles, 0, 0)) {
+            std::cerr << "Error: Unable to write output file " << opts->out_file << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
     // 打開輸出文件
     std::ofstream out;
     out.open(opts->out_file, std::ofstream::trunc);
@@ -88,7 +137,23 @@ void write_file_parallel(struct options_t* opts, struct particle *bodies) {
     out.close();
 }
 
+// 三維只有一種文字格式，與循序版相同
+void write_file_parallel(struct options_t* opts, struct particle3 *bodies) {
+    write_file(opts, opts->n_particles, bodies);
+}
+
 void read_file(const options_t* args, int* n_particles, particle** particles) {
+    if (isSnapshotPath(args->in_file)) {
+        Snapshot snap;
+        openSnapshot(args->in_file, &snap);
+        checkSnapshotDims(&snap.header, 2, args->in_file);
+        *n_particles = (int)snap.header.n;
+        *particles = (particle*)malloc(*n_particles * sizeof(particle));
+        copySnapshot(&snap, 0, *n_particles, *particles);
+        closeSnapshot(&snap);
+        return;
+    }
+
     // 打開輸入文件
     FILE* input_f = fopen(args->in_file.c_str(), "r");
     if (!input_f) {
@@ -121,12 +186,22 @@ void read_file(const options_t* args, int* n_particles, particle** particles) {
             free(*particles);
             exit(EXIT_FAILURE);
         }
+        (*particles)[i].cost = 0;
+        (*particles)[i].a_x = (*particles)[i].a_y = 0.0;
     }
 
     fclose(input_f);
 }
 
 void write_file(const options_t* args, int n_particles, const particle* particles) {
+    if (isSnapshotPath(args->out_file)) {
+        if (!writeSnapshot(args->out_file, particles, n_particles, 0, 0)) {
+            std::cerr << "Error: Unable to write output file " << args->out_file << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
     // 打開輸出文件
     FILE* output_f = fopen(args->out_file.c_str(), "w");
     if (!output_f) {
@@ -150,3 +225,120 @@ void write_file(const options_t* args, int n_particles, const particle* particle
 
     fclose(output_f);
 }
+
+
+void read_file(const options_t* args, int* n_particles, particle3** particles) {
+    if (isSnapshotPath(args->in_file)) {
+        Snapshot snap;
+        openSnapshot(args->in_file, &snap);
+        checkSnapshotDims(&snap.header, 3, args->in_file);
+        *n_particles = (int)snap.header.n;
+        *particles = (particle3*)malloc(*n_particles * sizeof(particle3));
+        copySnapshot(&snap, 0, *n_particles, *particles);
+        closeSnapshot(&snap);
+        return;
+    }
+
+    FILE* input_f = fopen(args->in_file.c_str(), "r");
+    if (!input_f) {
+        std::cerr << "Error: Unable to open input file " << args->in_file << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int scanned = fscanf(input_f, "%d", n_particles);
+    if (scanned != 1) {
+        std::cerr << "Error reading number of particles! Scanned: " << scanned << std::endl;
+        fclose(input_f);
+        exit(EXIT_FAILURE);
+    }
+
+    *particles = (particle3*)malloc(*n_particles * sizeof(particle3));
+
+    for (int i = 0; i < *n_particles; ++i) {
+        particle3* p = &(*particles)[i];
+        scanned = fscanf(input_f, "%d\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf",
+                         &p->index, &p->x, &p->y, &p->z, &p->mass, &p->v_x, &p->v_y, &p->v_z);
+        if (scanned != 8) {
+            std::cerr << "Error reading particle! Scanned: " << scanned << std::endl;
+            fclose(input_f);
+            free(*particles);
+            exit(EXIT_FAILURE);
+        }
+        p->cost = 0;
+        p->a_x = p->a_y = p->a_z = 0.0;
+    }
+
+    fclose(input_f);
+}
+
+void write_file(const options_t* args, int n_particles, const particle3* particles) {
+    if (isSnapshotPath(args->out_file)) {
+        if (!writeSnapshot(args->out_file, particles, n_particles, 0, 0)) {
+            std::cerr << "Error: Unable to write output file " << args->out_file << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    FILE* output_f = fopen(args->out_file.c_str(), "w");
+    if (!output_f) {
+        std::cerr << "Error: Unable to open output file " << args->out_file << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(output_f, "%d\n", n_particles);
+    for (int i = 0; i < n_particles; ++i) {
+        const particle3* p = &particles[i];
+        fprintf(output_f, "%d\t%.17lf\t%.17lf\t%.17lf\t%.17lf\t%.17lf\t%.17lf\t%.17lf\n",
+                p->index, p->x, p->y, p->z, p->mass, p->v_x, p->v_y, p->v_z);
+    }
+
+    fclose(output_f);
+}
+
+// 把 n 個粒子切成 n_parts 段連續區間 (數量相差不超過一)，只保留第 part 段。
+// opts->n_particles 設為檔案中的粒子總數
+void read_file_slice(struct options_t* opts, int part, int n_parts, struct particle **bodies, int* n_local) {
+    const bool binary = isSnapshotPath(opts->in_file);
+    Snapshot snap;
+    std::ifstream in;
+    if (binary) {
+        openSnapshot(opts->in_file, &snap);
+        checkSnapshotDims(&snap.header, 2, opts->in_file);
+        opts->n_particles = (int)snap.header.n;
+    } else {
+        in.open(opts->in_file);
+        if (!in) {
+            std::cerr << "Error: Unable to open input file " << opts->in_file << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        in >> opts->n_particles;
+    }
+    if ((opts->n_particles) <= 0 || (opts->n_particles) > INT_MAX) {
+        std::cerr << "Invalid number of inputs in input file" << std::endl;
+        exit(1);
+    }
+
+    int n = opts->n_particles;
+    int lo = part * (n / n_parts) + (part < n % n_parts ? part : n % n_parts);
+    int hi = lo + n / n_parts + (part < n % n_parts ? 1 : 0);
+    *n_local = hi - lo;
+    *bodies = (struct particle *)malloc((hi - lo > 0 ? hi - lo : 1) * sizeof(struct particle));
+
+    // 二進位快照只需複製自己的一段；文字檔必須從頭讀過前面的粒子
+    if (binary) {
+        copySnapshot(&snap, lo, hi - lo, *bodies);
+        closeSnapshot(&snap);
+    }
+    struct particle tmp;
+    for (int i = binary ? lo : 0; i < hi; ++i) {
+        struct particle *b = i >= lo ? &((*bodies)[i - lo]) : &tmp;
+        if (!binary) {
+            in >> b->index >> b->x >> b->y >> b->mass >> b->v_x >> b->v_y;
+            b->cost = 0;
+            b->a_x = b->a_y = 0.0;
+        }
+        if (opts->domain == "fixed" && (b->x < MIN_X || b->y < MIN_Y || b->x > MAX_X || b->y > MAX_Y))
+            b->mass = OUT_OF_BOUNDS_MASS;
+    }
+}
@@ -9,7 +9,16 @@ void read_file(const options_t* args, int* numParticles, particle** particles);
 
 void write_file(const options_t* args, int numParticles, const particle* particles);
 
+// --dims 3：文字檔每行 index x y z mass v_x v_y v_z，或三維的 .bhs 快照
+void read_file(const options_t* args, int* numParticles, particle3** particles);
+
+void write_file(const options_t* args, int numParticles, const particle3* particles);
+
 void read_file_parallel(struct options_t* opts, struct particle **bodies, int size);
+void read_file_parallel(struct options_t* opts, struct particle3 **bodies, int size);
 
 void write_file_parallel(struct options_t* opts,
-                struct particle *bodies);
\ No newline at end of file
+                struct particle *bodies);
+void write_file_parallel(struct options_t* opts, struct particle3 *bodies);
+
+void read_file_slice(struct options_t* opts, int part, int n_parts, struct particle **bodies, int* n_local);
\ No newline at end of file
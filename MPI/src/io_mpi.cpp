@@ -0,0 +1,271 @@
+#include "io_mpi.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <mpi.h>
+#include "common.h"
+#include "io.h"
+#include "snapshot.h"
+
+static void check_mpi_io(int rc, const char* what, const std::string& path) {
+    if (rc != MPI_SUCCESS) {
+        char msg[MPI_MAX_ERROR_STRING];
+        int len = 0;
+        MPI_Error_string(rc, msg, &len);
+        std::cerr << "Error: " << what << " " << path << ": " << msg << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+}
+
+// 檔案錯誤處理預設為 MPI_ERRORS_RETURN，讀寫不足時不會回報錯誤，需自行比對實際筆數
+static void check_mpi_count(MPI_Status* status, MPI_Datatype type, int expected, const char* what,
+                            const std::string& path) {
+    int got = 0;
+    MPI_Get_count(status, type, &got);
+    if (got != expected) {
+        std::cerr << "Error: " << what << " " << path << ": " << got << " of " << expected << " elements" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+}
+
+// 第 part 段 (共 n_parts 段，數量相差不超過一) 的範圍，與 read_file_slice 相同
+static void slice_range(int n, int part, int n_parts, int* lo, int* count) {
+    *lo = part * (n / n_parts) + (part < n % n_parts ? part : n % n_parts);
+    *count = n / n_parts + (part < n % n_parts ? 1 : 0);
+}
+
+// rank 0 讀檔頭並檢查 (含檔案大小) 後廣播給所有 rank
+static void read_snapshot_header(const std::string& path, int rank, SnapshotHeader* header) {
+    MPI_File fh;
+    check_mpi_io(MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh),
+                 "Unable to open input file", path);
+    if (rank == 0) {
+        MPI_Offset size = 0;
+        check_mpi_io(MPI_File_get_size(fh, &size), "Unable to read input file", path);
+        if ((size_t)size < sizeof(SnapshotHeader)) {
+            std::cerr << "Error: " << path << " is not a particle snapshot" << std::endl;
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        MPI_Status status;
+        check_mpi_io(MPI_File_read_at(fh, 0, header, sizeof(SnapshotHeader), MPI_BYTE, &status),
+                     "Unable to read input file", path);
+        check_mpi_count(&status, MPI_BYTE, sizeof(SnapshotHeader), "Short read from", path);
+        checkSnapshotHeader(header, path);
+        if (snapshotFileSize(header) > (size_t)size) {
+            std::cerr << "Error: " << path << " is truncated" << std::endl;
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+    }
+    MPI_Bcast(header, sizeof(SnapshotHeader), MPI_BYTE, 0, MPI_COMM_WORLD);
+    check_mpi_io(MPI_File_close(&fh), "Unable to close input file", path);
+}
+
+// 集體讀入快照第 [lo, lo + count) 個粒子；每個欄位各一次 MPI_File_read_at_all
+template <typename P>
+static void read_snapshot_range(const std::string& path, const SnapshotHeader* header, int lo, int count, P* out) {
+    MPI_File fh;
+    check_mpi_io(MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh),
+                 "Unable to open input file", path);
+
+    std::vector<int32_t> index(count);
+    std::vector<double> fields[SNAP_AZ + 1];
+    MPI_Status status;
+    check_mpi_io(MPI_File_read_at_all(fh, snapshotFieldOffset(header, SNAP_INDEX) + (MPI_Offset)lo * sizeof(int32_t),
+                                      index.data(), count, MPI_INT32_T, &status),
+                 "Unable to read input file", path);
+    check_mpi_count(&status, MPI_INT32_T, count, "Short read from", path);
+    const bool accel = header->flags & SNAPSHOT_ACCEL;
+    const bool three = header->flags & SNAPSHOT_3D;
+    for (int f = SNAP_X; f <= SNAP_AZ; f++) {
+        // 加速度只在 SNAPSHOT_ACCEL 時存在，z 欄位只在三維快照
+        bool present = f <= SNAP_VY || (f <= SNAP_AY ? accel : three && (f != SNAP_AZ || accel));
+        if (!present) continue;
+        fields[f].resize(count);
+        MPI_Offset at = snapshotFieldOffset(header, (SnapshotField)f) + (MPI_Offset)lo * sizeof(double);
+        check_mpi_io(MPI_File_read_at_all(fh, at, fields[f].data(), count, MPI_DOUBLE, &status),
+                     "Unable to read input file", path);
+        check_mpi_count(&status, MPI_DOUBLE, count, "Short read from", path);
+    }
+    check_mpi_io(MPI_File_close(&fh), "Unable to close input file", path);
+
+    // 讀進來的是 SoA，借用 copySnapshot 轉成粒子結構
+    Snapshot snap;
+    snap.header = *header;
+    snap.index = index.data();
+    snap.x = fields[SNAP_X].data();
+    snap.y = fields[SNAP_Y].data();
+    snap.mass = fields[SNAP_MASS].data();
+    snap.v_x = fields[SNAP_VX].data();
+    snap.v_y = fields[SNAP_VY].data();
+    if (header->flags & SNAPSHOT_ACCEL) {
+        snap.a_x = fields[SNAP_AX].data();
+        snap.a_y = fields[SNAP_AY].data();
+    }
+    if (three) {
+        snap.z = fields[SNAP_Z].data();
+        snap.v_z = fields[SNAP_VZ].data();
+        if (accel) {
+            snap.a_z = fields[SNAP_AZ].data();
+        }
+    }
+    copySnapshot(&snap, 0, count, out);
+}
+
+// 固定領域下把起始位置就在領域外的粒子標記為出界；自適應領域不標記
+template <typename P>
+static void mark_out_of_bounds(const struct options_t* opts, P* bodies, int n) {
+    if (opts->domain != "fixed") {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        P* b = &bodies[i];
+        if (b->x < MIN_X || b->y < MIN_Y || b->x > MAX_X || b->y > MAX_Y)
+            b->mass = OUT_OF_BOUNDS_MASS;
+        if constexpr (dims_of<P>::value == 3) {
+            if (b->z < MIN_X || b->z > MAX_X)
+                b->mass = OUT_OF_BOUNDS_MASS;
+        }
+    }
+}
+
+template <typename P>
+static void readFileMpi(struct options_t* opts, P** bodies, int num_procs) {
+    if (!isSnapshotPath(opts->in_file)) {
+        read_file_parallel(opts, bodies, num_procs);
+        return;
+    }
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    SnapshotHeader header;
+    read_snapshot_header(opts->in_file, rank, &header);
+    checkSnapshotDims(&header, dims_of<P>::value, opts->in_file);
+    opts->n_particles = (int)header.n;
+
+    // 補齊到 num_procs 的倍數，與 read_file_parallel 相同
+    int totalBodies = opts->n_particles;
+    if (num_procs > 1) {
+        totalBodies = opts->n_particles + ((num_procs - opts->n_particles % num_procs) % num_procs);
+    }
+    opts->n_bodiesParallel = totalBodies;
+    *bodies = (P*)malloc(totalBodies * sizeof(P));
+    memset((char*)(*bodies), 0, totalBodies * sizeof(P));
+
+    std::vector<int> counts(size), displs(size);
+    for (int r = 0; r < size; r++) {
+        slice_range(opts->n_particles, r, size, &displs[r], &counts[r]);
+        counts[r] *= sizeof(P);
+        displs[r] *= sizeof(P);
+    }
+    int lo, count;
+    slice_range(opts->n_particles, rank, size, &lo, &count);
+    read_snapshot_range(opts->in_file, &header, lo, count, &(*bodies)[lo]);
+    mark_out_of_bounds(opts, &(*bodies)[lo], count);
+
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, *bodies, counts.data(), displs.data(),
+                   MPI_BYTE, MPI_COMM_WORLD);
+
+    for (int i = opts->n_particles; i < totalBodies; i++) {
+        (*bodies)[i].index = -10;
+    }
+}
+
+void read_file_mpi(struct options_t* opts, struct particle** bodies, int num_procs) {
+    readFileMpi(opts, bodies, num_procs);
+}
+
+void read_file_mpi(struct options_t* opts, struct particle3** bodies, int num_procs) {
+    readFileMpi(opts, bodies, num_procs);
+}
+
+void read_file_slice_mpi(struct options_t* opts, int rank, int num_procs, struct particle** bodies, int* n_local) {
+    if (!isSnapshotPath(opts->in_file)) {
+        read_file_slice(opts, rank, num_procs, bodies, n_local);
+        return;
+    }
+
+    SnapshotHeader header;
+    read_snapshot_header(opts->in_file, rank, &header);
+    checkSnapshotDims(&header, 2, opts->in_file);
+    opts->n_particles = (int)header.n;
+
+    int lo, count;
+    slice_range(opts->n_particles, rank, num_procs, &lo, &count);
+    *n_local = count;
+    *bodies = (struct particle*)malloc((count > 0 ? count : 1) * sizeof(struct particle));
+    read_snapshot_range(opts->in_file, &header, lo, count, *bodies);
+    mark_out_of_bounds(opts, *bodies, count);
+}
+
+// 把 slice 的某個欄位轉成連續陣列，集體寫到該欄位陣列中的第 offset 個位置
+template <typename T, typename P, typename Get>
+static void write_field_all(MPI_File fh, const std::string& path, const SnapshotHeader* header, SnapshotField field,
+                            MPI_Datatype type, const P* slice, int offset, int count, Get get) {
+    std::vector<T> buf(count);
+    for (int i = 0; i < count; i++) {
+        buf[i] = get(slice[i]);
+    }
+    MPI_Status status;
+    check_mpi_io(MPI_File_write_at_all(fh, snapshotFieldOffset(header, field) + (MPI_Offset)offset * sizeof(T),
+                                       buf.data(), count, type, &status),
+                 "Unable to write output file", path);
+    check_mpi_count(&status, type, count, "Short write to", path);
+}
+
+template <typename P>
+static void writeSnapshotMpi(const struct options_t* opts, const P* slice, int offset, int count) {
+    constexpr bool three = dims_of<P>::value == 3;
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    SnapshotHeader header;
+    initSnapshotHeader(&header, opts->n_particles, 0, three ? SNAPSHOT_3D : 0);
+
+    MPI_File fh;
+    check_mpi_io(MPI_File_open(MPI_COMM_WORLD, opts->out_file.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                               MPI_INFO_NULL, &fh),
+                 "Unable to open output file", opts->out_file);
+    // 先把檔案設成正確大小，覆寫較大的舊檔時不會留下多餘的尾巴
+    const std::string& path = opts->out_file;
+    check_mpi_io(MPI_File_set_size(fh, snapshotFileSize(&header)), "Unable to write output file", path);
+    if (rank == 0) {
+        MPI_Status status;
+        check_mpi_io(MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, &status),
+                     "Unable to write output file", path);
+        check_mpi_count(&status, MPI_BYTE, sizeof(header), "Short write to", path);
+    }
+
+    write_field_all<int32_t>(fh, path, &header, SNAP_INDEX, MPI_INT32_T, slice, offset, count,
+                             [](const P& b) { return (int32_t)b.index; });
+    write_field_all<double>(fh, path, &header, SNAP_X, MPI_DOUBLE, slice, offset, count, [](const P& b) { return b.x; });
+    write_field_all<double>(fh, path, &header, SNAP_Y, MPI_DOUBLE, slice, offset, count, [](const P& b) { return b.y; });
+    write_field_all<double>(fh, path, &header, SNAP_MASS, MPI_DOUBLE, slice, offset, count, [](const P& b) { return b.mass; });
+    write_field_all<double>(fh, path, &header, SNAP_VX, MPI_DOUBLE, slice, offset, count, [](const P& b) { return b.v_x; });
+    write_field_all<double>(fh, path, &header, SNAP_VY, MPI_DOUBLE, slice, offset, count, [](const P& b) { return b.v_y; });
+    if constexpr (three) {
+        write_field_all<double>(fh, path, &header, SNAP_Z, MPI_DOUBLE, slice, offset, count, [](const P& b) { return b.z; });
+        write_field_all<double>(fh, path, &header, SNAP_VZ, MPI_DOUBLE, slice, offset, count, [](const P& b) { return b.v_z; });
+    }
+
+    check_mpi_io(MPI_File_close(&fh), "Unable to close output file", path);
+}
+
+void write_snapshot_mpi(const struct options_t* opts, const struct particle* slice, int offset, int count) {
+    writeSnapshotMpi(opts, slice, offset, count);
+}
+
+void write_snapshot_mpi(const struct options_t* opts, const struct particle3* slice, int offset, int count) {
+    writeSnapshotMpi(opts, slice, offset, count);
+}
+
+void write_file_mpi(struct options_t* opts, int rank, struct particle* bodies, int lo, int count) {
+    if (isSnapshotPath(opts->out_file)) {
+        write_snapshot_mpi(opts, &bodies[lo], lo, count);
+    } else if (rank == 0) {
+        write_file_parallel(opts, bodies);
+    }
+}
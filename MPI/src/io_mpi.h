@@ -0,0 +1,24 @@
+#pragma once
+
+#include "argparse.h"
+#include "particle.h"
+
+// 以 MPI-IO 集體讀寫二進位快照 (.bhs)：每個 rank 只讀寫屬於自己那一段的位元組。
+// 輸入不是 .bhs 時退回 io.h 的文字格式讀取。所有函數都必須由每個 rank 一起呼叫。
+
+// 與 read_file_parallel 相同：回傳完整 (補齊到 num_procs 的倍數) 的粒子陣列。
+// 各 rank 只從檔案讀自己的一段，其餘以 MPI_Allgatherv 從其他 rank 取得
+void read_file_mpi(struct options_t* opts, struct particle** bodies, int num_procs);
+void read_file_mpi(struct options_t* opts, struct particle3** bodies, int num_procs);
+
+// 與 read_file_slice 相同：只保留第 rank 段
+void read_file_slice_mpi(struct options_t* opts, int rank, int num_procs, struct particle** bodies, int* n_local);
+
+// 輸出完整的粒子陣列 bodies：.bhs 時每個 rank 集體寫出自己負責的 [lo, lo + count)，
+// 文字格式則由 rank 0 寫出 (此時 rank 0 的 bodies 必須是最新的)
+void write_file_mpi(struct options_t* opts, int rank, struct particle* bodies, int lo, int count);
+
+// 把 slice[0, count) 寫到快照 opts->out_file 的第 [offset, offset + count) 個粒子，
+// 檔案共 opts->n_particles 個粒子，檔頭由 rank 0 寫入
+void write_snapshot_mpi(const struct options_t* opts, const struct particle* slice, int offset, int count);
+void write_snapshot_mpi(const struct options_t* opts, const struct particle3* slice, int offset, int count);
@@ -3,6 +3,7 @@
 #include "argparse.h"
 #include "sequential.h"
 #include "parallel_mpi.h"
+#include "domain_mpi.h"
 #include <mpi.h>
 //#include "visualization.cpp"
 
@@ -24,7 +25,9 @@ int main(int argc, char** argv) {
     DEBUG_PRINT(std::cout << "---------------------------------" << std::endl);
 #endif*/
     int size, rank;
-    MPI_Init(&argc, &argv);
+    // 只有主執行緒呼叫 MPI，工作執行緒僅負責計算
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     /*if(options.visualization){
@@ -39,6 +42,14 @@ int main(int argc, char** argv) {
         return BHSeq(&options); // 返回 `BHSeq` 的結果
     } else {
         DEBUG_PRINT(std::cout << "MPI version" << std::endl);
+        // 區塊時間步每個子步只更新部分粒子，目前只有循序版 (搭配 --threads) 支援
+        if (options.block_levels > 0) {
+            if (rank == 0) {
+                std::cerr << "Error: --block-levels is only supported without MPI; use --threads" << std::endl;
+            }
+            MPI_Finalize();
+            return EXIT_FAILURE;
+        }
         
         //std::cout << "Size:" << size << std::endl;
         // 將 `options` 傳遞為指標
@@ -54,6 +65,18 @@ int main(int argc, char** argv) {
         {
           return parallel_mpi_send_recv(&options, rank, size); // 呼叫 `barnes_hut_mpi`，它的返回值是 void
         }
+        if(options.mpi_type=="v")
+        {
+          return parallel_mpi_allgatherv(&options, rank, size);
+        }
+        if(options.mpi_type=="o")
+        {
+          return parallel_mpi_overlap(&options, rank, size);
+        }
+        if(options.mpi_type=="d")
+        {
+          return parallel_mpi_domain(&options, rank, size);
+        }
 
     }
 
@@ -0,0 +1,156 @@
+#include "morton.h"
+#include <cstring>
+#include "common.h"
+
+// 將 32 位元整數的各位元分散到偶數位置
+static inline uint64_t spreadBits(uint64_t v) {
+    v &= 0xffffffffULL;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v | (v << 8))  & 0x00ff00ff00ff00ffULL;
+    v = (v | (v << 4))  & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v << 2))  & 0x3333333333333333ULL;
+    v = (v | (v << 1))  & 0x5555555555555555ULL;
+    return v;
+}
+
+// 2D Morton (Z 曲線) 編碼：每兩個位元為一層，高位元為北、低位元為東
+uint64_t mortonKey(const Node* root, double x, double y) {
+    const double scale = 4294967296.0; // 2^32
+    double fx = (x - root->min_bound[0]) / (root->max_bound[0] - root->min_bound[0]) * scale;
+    double fy = (y - root->min_bound[1]) / (root->max_bound[1] - root->min_bound[1]) * scale;
+    uint64_t ix = fx <= 0 ? 0 : (fx >= scale ? 0xffffffffULL : (uint64_t)fx);
+    uint64_t iy = fy <= 0 ? 0 : (fy >= scale ? 0xffffffffULL : (uint64_t)fy);
+    return (spreadBits(iy) << 1) | spreadBits(ix);
+}
+
+// LSD 基數排序 (每趟 8 位元)，同時搬動 tree->order；全部相同的位元組直接跳過
+void radixSortKeys(Tree* tree, int n) {
+    tree->keys_tmp.resize(n);
+    tree->order_tmp.resize(n);
+    uint64_t* keys = tree->keys.data();
+    int32_t* order = tree->order.data();
+    uint64_t* keys_out = tree->keys_tmp.data();
+    int32_t* order_out = tree->order_tmp.data();
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        int count[256];
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < n; ++i) {
+            count[(keys[i] >> shift) & 0xff]++;
+        }
+        if (n == 0 || count[(keys[0] >> shift) & 0xff] == n) continue;
+
+        int offset = 0;
+        for (int d = 0; d < 256; ++d) {
+            int c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+        for (int i = 0; i < n; ++i) {
+            int dst = count[(keys[i] >> shift) & 0xff]++;
+            keys_out[dst] = keys[i];
+            order_out[dst] = order[i];
+        }
+        std::swap(keys, keys_out);
+        std::swap(order, order_out);
+    }
+
+    if (keys != tree->keys.data()) {
+        tree->keys.swap(tree->keys_tmp);
+        tree->order.swap(tree->order_tmp);
+    }
+}
+
+// 在已排序的 [lo, hi) 區間中，以第 level 層的兩個位元切出四個象限，
+// 子節點先配置再遞迴，最後由下而上彙總質心。粒子數不超過 leaf_size 時成為葉節點。
+static void buildRange(const options_t* opts, Tree* tree, int32_t n, int lo, int hi, int level) {
+    const BodyHot* bodies = tree->bodies->hot.data();
+    const int32_t* order = tree->order.data();
+    const uint64_t* keys = tree->keys.data();
+
+    if (hi - lo <= opts->leaf_size || level == MORTON_BITS || level == MAX_TREE_DEPTH) {
+        Node* leaf = &tree->nodes[n];
+        leaf->first = lo;
+        leaf->count = hi - lo;
+        leaf->bIdx = NO_BODY;
+        for (int i = lo; i < hi; ++i) {
+            tree->next[order[i]] = leaf->bIdx;
+            leaf->bIdx = order[i];
+        }
+        if (hi - lo == 1) {
+            const BodyHot* p = &bodies[order[lo]];
+            leaf->com[0] = p->x;
+            leaf->com[1] = p->y;
+            leaf->mass = p->mass;
+            return;
+        }
+        double mass = 0.0, cx = 0.0, cy = 0.0;
+        for (int i = lo; i < hi; ++i) {
+            const BodyHot* p = &bodies[order[i]];
+            mass += p->mass;
+            cx += p->mass * p->x;
+            cy += p->mass * p->y;
+        }
+        leaf->mass = mass;
+        leaf->com[0] = cx / mass;
+        leaf->com[1] = cy / mass;
+        return;
+    }
+
+    splitNode(tree, n);
+    tree->nodes[n].has_children = true;
+    tree->nodes[n].first = lo;
+    tree->nodes[n].count = hi - lo;
+
+    int shift = 2 * (MORTON_BITS - 1 - level);
+    int begin = lo;
+    for (int digit = 0; digit < 4; ++digit) {
+        int end = begin;
+        while (end < hi && (int)((keys[end] >> shift) & 3) == digit) {
+            end++;
+        }
+        // digit 的位元為 (北, 東)，對應子節點順序 東北、西北、東南、西南
+        Node* child = &tree->nodes[tree->nodes[n].chd[3 - digit]];
+        child->first = begin;
+        if (end > begin) {
+            buildRange(opts, tree, tree->nodes[n].chd[3 - digit], begin, end, level + 1);
+        }
+        begin = end;
+    }
+
+    Node* node = &tree->nodes[n];
+    double mass = 0.0, cx = 0.0, cy = 0.0;
+    for (int c = 0; c < 4; ++c) {
+        const Node* child = &tree->nodes[node->chd[c]];
+        mass += child->mass;
+        cx += child->mass * child->com[0];
+        cy += child->mass * child->com[1];
+    }
+    node->mass = mass;
+    node->com[0] = cx / mass;
+    node->com[1] = cy / mass;
+}
+
+void buildTreeMorton(const options_t* opts, Tree* tree, Bodies* bodies, int n) {
+    initialize_root(tree, bodies);
+    const Node* root = tree_root(tree);
+
+    tree->keys.resize(n);
+    tree->order.resize(n);
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        const BodyHot* p = &bodies->hot[i];
+        if (p->mass == OUT_OF_BOUNDS_MASS || !contains(root, p)) continue;
+        tree->keys[m] = mortonKey(root, p->x, p->y);
+        tree->order[m] = i;
+        m++;
+    }
+    tree->keys.resize(m);
+    tree->order.resize(m);
+
+    radixSortKeys(tree, m);
+    tree->next.resize(n);
+    if (m > 0) {
+        buildRange(opts, tree, 0, 0, m, 0);
+    }
+}
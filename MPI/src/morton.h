@@ -0,0 +1,15 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>
+#include "argparse.h"
+#include "bodies.h"
+#include "tree.h"
+
+constexpr int MORTON_BITS = 32;     // 每個維度的量化位元數，也是樹的最大深度
+
+uint64_t mortonKey(const Node* root, double x, double y);
+void radixSortKeys(Tree* tree, int n);
+void buildTreeMorton(const options_t* opts, Tree* tree, Bodies* bodies, int n);
+
+#endif // MORTON_H
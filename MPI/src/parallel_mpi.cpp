@@ -5,8 +5,18 @@
 #include <iostream>
 #include <cstring>  // 使用 memset 初始化內存
 #include <array>
+#include <utility>
 #include "io.h"
+#include "io_mpi.h"
 #include "tree.h"
+#include "thread_pool.h"
+#include "force.h"
+#include "balance.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "integrator.h"
+#include "profile.h"
+#include "common.h"
 
 // 定義 MPI 粒子類型
 /*void define_particle_mpi_type(MPI_Datatype* particle_mpi_type) {
@@ -27,10 +37,69 @@
 MPI_Datatype mpiBody;
 extern MPI_Datatype mpiBody;
 
+// 熱資料 (位置與質量) 與冷資料的型別，分別用在 Bodies::hot 與 Bodies::cold 上。
+// 每步交換只需要熱資料，一個粒子 24 bytes (三維 32 bytes)；冷資料只在重新分配粒子與寫檔前才送
+MPI_Datatype mpiBodyHot;
+MPI_Datatype mpiBodyCold;
+MPI_Datatype mpiBodyHot3;
+MPI_Datatype mpiBodyCold3;
+
+// 熱資料為 D + 1 個連續的 double；冷資料為 D 個速度、D 個加速度，再接 index 與 cost
+template <int D>
+static void createBodyMPITypes(MPI_Datatype* hot, MPI_Datatype* cold) {
+    using Cold = BodyColdT<D>;
+    MPI_Type_contiguous(D + 1, MPI_DOUBLE, hot);
+    MPI_Type_commit(hot);
+
+    constexpr int N_FIELDS = 2 * D + 2;
+    int blocklengths[N_FIELDS];
+    MPI_Datatype types[N_FIELDS];
+    MPI_Aint offsets[N_FIELDS];
+    for (int f = 0; f < N_FIELDS; f++) {
+        blocklengths[f] = 1;
+        types[f] = f < 2 * D ? MPI_DOUBLE : MPI_INT;
+    }
+
+    offsets[0] = offsetof(Cold, v_x);
+    offsets[1] = offsetof(Cold, v_y);
+    if constexpr (D == 3) {
+        offsets[2] = offsetof(Cold, v_z);
+    }
+    offsets[D] = offsetof(Cold, a_x);
+    offsets[D + 1] = offsetof(Cold, a_y);
+    if constexpr (D == 3) {
+        offsets[D + 2] = offsetof(Cold, a_z);
+    }
+    offsets[2 * D] = offsetof(Cold, index);
+    offsets[2 * D + 1] = offsetof(Cold, cost);
+
+    MPI_Datatype packed;
+    MPI_Type_create_struct(N_FIELDS, blocklengths, offsets, types, &packed);
+    MPI_Type_create_resized(packed, 0, sizeof(Cold), cold);
+    MPI_Type_commit(cold);
+    MPI_Type_free(&packed);
+}
+
+static void initializeBodyMPITypes(){
+    createBodyMPITypes<2>(&mpiBodyHot, &mpiBodyCold);
+    createBodyMPITypes<3>(&mpiBodyHot3, &mpiBodyCold3);
+}
+
+// D 維粒子的熱 / 冷資料型別
+template <int D>
+static MPI_Datatype bodyHotType() {
+    return D == 3 ? mpiBodyHot3 : mpiBodyHot;
+}
+
+template <int D>
+static MPI_Datatype bodyColdType() {
+    return D == 3 ? mpiBodyCold3 : mpiBodyCold;
+}
+
 void initializeMPITypes(){
-    int blocklengths[] = {1, 1,1, 1,1, 1,1,1};
-    MPI_Datatype types[] = {MPI_INT, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE,MPI_DOUBLE, MPI_DOUBLE,MPI_DOUBLE, MPI_DOUBLE};
-    MPI_Aint offsets[8];
+    int blocklengths[] = {1, 1,1, 1,1, 1,1,1, 1};
+    MPI_Datatype types[] = {MPI_INT, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE,MPI_DOUBLE, MPI_DOUBLE,MPI_DOUBLE, MPI_DOUBLE, MPI_INT};
+    MPI_Aint offsets[9];
 
     offsets[0] = offsetof(struct particle, index);
     offsets[1] = offsetof(struct particle, x);
@@ -40,13 +109,19 @@ void initializeMPITypes(){
     offsets[5] = offsetof(struct particle, mass);
     offsets[6] = offsetof(struct particle, a_x);
     offsets[7] = offsetof(struct particle, a_y);
+    offsets[8] = offsetof(struct particle, cost);
 
-    MPI_Type_create_struct(8, blocklengths, offsets, types, &mpiBody);
+    MPI_Type_create_struct(9, blocklengths, offsets, types, &mpiBody);
     MPI_Type_commit(&mpiBody);
+    initializeBodyMPITypes();
 }
 
 void freeMPITypes(){
     MPI_Type_free(&mpiBody);
+    MPI_Type_free(&mpiBodyHot);
+    MPI_Type_free(&mpiBodyCold);
+    MPI_Type_free(&mpiBodyHot3);
+    MPI_Type_free(&mpiBodyCold3);
 }
 
 
@@ -75,15 +150,63 @@ MPI_Datatype define_particle_type() {
 }
 
 
-int parallel_mpi(options_t* opts, int rank, int num_procs) {
+// 每步只交換熱資料，其他 rank 的速度與加速度並未同步；
+// 寫檢查點或文字輸出前把每個 rank 自己那一段的冷資料收集到 rank 0
+template <int D>
+static void gather_cold(BodiesT<D>* bodies, const std::vector<int>& counts, const std::vector<int>& displs,
+                        int rank) {
+    if (rank == 0) {
+        MPI_Gatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies->cold.data(), counts.data(), displs.data(),
+                    bodyColdType<D>(), 0, MPI_COMM_WORLD);
+    } else {
+        MPI_Gatherv(&bodies->cold[displs[rank]], counts[rank], bodyColdType<D>(), NULL, NULL, NULL,
+                    bodyColdType<D>(), 0, MPI_COMM_WORLD);
+    }
+}
+
+// 讀入完整的粒子陣列 (補齊到 num_procs 的倍數) 並轉成 Bodies
+template <int D>
+static void read_bodies_mpi(options_t* opts, BodiesT<D>* bodies, int num_procs) {
+    particle_t<D>* input = NULL;
+    read_file_mpi(opts, &input, num_procs);
+    splitBodies(input, opts->n_bodiesParallel, bodies);
+    free(input);
+}
+
+// 與 write_file_mpi 相同：.bhs 時每個 rank 只轉換並寫出自己的 [lo, lo + count)，
+// 文字格式由 rank 0 轉換整個陣列後寫出 (此時 rank 0 的冷資料必須是最新的)
+template <int D>
+static void write_bodies_mpi(options_t* opts, int rank, const BodiesT<D>& bodies, int lo, int count) {
+    if (isSnapshotPath(opts->out_file)) {
+        std::vector<particle_t<D>> slice(count);
+        joinBodies(bodies, lo, count, slice.data());
+        write_snapshot_mpi(opts, slice.data(), lo, count);
+    } else if (rank == 0) {
+        std::vector<particle_t<D>> all(opts->n_particles);
+        joinBodies(bodies, 0, opts->n_particles, all.data());
+        write_file_parallel(opts, all.data());
+    }
+}
+
+// 補齊後每個 rank 各 subGrps 個粒子 (mpi_type a / s)
+static void equal_counts(int subGrps, int num_procs, std::vector<int>* counts, std::vector<int>* displs) {
+    counts->assign(num_procs, subGrps);
+    displs->resize(num_procs);
+    for (int r = 0; r < num_procs; r++) {
+        (*displs)[r] = r * subGrps;
+    }
+}
+
+template <int D>
+static int runAllgather(options_t* opts, int rank, int num_procs) {
 
     //struct options_t opts;
-    double dt;
     double start_time, stop_time;
-    struct particle *bodies = NULL;
-    struct Node *root;
-    int s,i,c;
-    struct particle *tempBodies = NULL;
+    BodiesT<D> bodies;
+    ForceEngineT<D> engine;
+    ThreadPool pool(opts->n_threads);
+    int s;
+    RunProfile profile;
 
     //get_opts(argc, argv, &opts);
 
@@ -100,59 +223,88 @@ int parallel_mpi(options_t* opts, int rank, int num_procs) {
 #endif*/
     //DEBUG_PRINT(std::cout << "Reading particle data from file: " << opts->in_file << std::endl);
     
-    read_file_parallel(opts, &bodies,num_procs);
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        read_bodies_mpi(opts, &bodies, num_procs);
+    }
 
-    dt = opts->timestep;
 
     int subGrps = opts->n_bodiesParallel/num_procs;
+    std::vector<int> counts, displs;
+    equal_counts(subGrps, num_procs, &counts, &displs);
 
     initializeMPITypes();
     MPI_Barrier(MPI_COMM_WORLD);
     start_time = MPI_Wtime();
 
-    for (s = 0; s < opts->n_steps; s++) {
+    CheckpointWriterT<D> checkpoint(checkpointPath(opts));
+    for (s = firstIteration(opts); s < endIteration(opts); s++) {
 
-        tempBodies = &bodies[(rank*subGrps)];
+        int lo = rank * subGrps;
 
-        root = (struct Node *)malloc(sizeof(struct Node));
-        memset((char *)root, 0, sizeof(struct Node));
-
-        initialize_root(root);
-
-        for (int i = 0; i < opts->n_particles; ++i) {
-            insertBody(opts, root, &bodies[i]);
+        {
+            PhaseTimer timer(&profile, PHASE_BUILD);
+            buildForceTree(opts, &engine, &pool, &bodies, opts->n_particles, s);
         }
+        profileTree(opts, &profile, &engine.tree);
 
         /* Compute forces */
-        std::vector<std::array<double, 2>> forces(subGrps, std::array<double, 2>{0, 0});
-        //std::vector<array<double, 2>> forces(subGrps, {0,0});
-        for(i = 0; i < subGrps; i++) {
-            struct particle *body = &tempBodies[i];
-            if (body->index == -10) continue;
-            forces[i]= compute_force_v2(opts, root, body);
+        std::vector<vec_t<D>> forces(subGrps);
+        {
+            PhaseTimer timer(&profile, PHASE_FORCE);
+            computeForces(opts, &engine, &pool, lo, lo + subGrps, forces.data());
         }
+        profileBodies(&profile, bodies.cold.data(), lo, lo + subGrps);
+        profile.steps++;
 
         /* Update positions */
-        for(i = 0; i < subGrps; i++) {
-            struct particle *body = &tempBodies[i];
-            if (body->index == -10) continue;
-            updateParticleState(body, dt, root);
+        {
+            PhaseTimer timer(&profile, PHASE_UPDATE);
+            pool.parallel_for(subGrps, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                for (int j = lo + begin; j < lo + end; j++) {
+                    BodyColdT<D> *cold = &bodies.cold[j];
+                    if (cold->index == -10) continue;
+                    advanceBody(opts, &bodies.hot[j], cold, s, tree_root(&engine.tree));
+                }
+            });
+        }
+
+        // 只交換位置與質量，速度與加速度留在各自的 rank
+        {
+            PhaseTimer timer(&profile, PHASE_COMM);
+            MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.hot.data(), subGrps, bodyHotType<D>(), MPI_COMM_WORLD);
         }
 
-        MPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies, subGrps, mpiBody, MPI_COMM_WORLD);
+        releaseForceTree(opts, &engine);
 
-        tearDownTree(root);
+        int done = completedStep(opts, s);
+        if (checkpointDue(opts, done)) {
+            PhaseTimer timer(&profile, PHASE_IO);
+            gather_cold(&bodies, counts, displs, rank);
+            if (rank == 0) {
+                checkpoint.write(bodies, opts->n_particles, done);
+            }
+        }
     }
 
     stop_time = MPI_Wtime();
+    profile.wall_time = stop_time - start_time;
 
     if (rank == 0) {
         printf("%f\n", (stop_time-start_time));
-        write_file_parallel(opts, bodies);
     }
-
-    if (bodies)
-        free(bodies);
+    // 最後一段含有補齊用的虛擬粒子，不寫出
+    int out_lo = rank * subGrps < opts->n_particles ? rank * subGrps : opts->n_particles;
+    int out_hi = (rank + 1) * subGrps < opts->n_particles ? (rank + 1) * subGrps : opts->n_particles;
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        if (!isSnapshotPath(opts->out_file)) {
+            gather_cold(&bodies, counts, displs, rank);
+        }
+        write_bodies_mpi(opts, rank, bodies, out_lo, out_hi - out_lo);
+    }
+    reportPrecision(opts, &engine, rank);
+    writeProfile(opts, &profile, opts->n_particles, rank, num_procs);
 
     /* Finalize */
     freeMPITypes();
@@ -161,76 +313,441 @@ int parallel_mpi(options_t* opts, int rank, int num_procs) {
     return 0;
 }
 
-int parallel_mpi_send_recv(options_t* opts, int rank, int num_procs) {
-    double dt;
+template <int D>
+static int runSendRecv(options_t* opts, int rank, int num_procs) {
     double start_time, stop_time;
-    struct particle *bodies = NULL;
-    struct Node *root;
-    int s, i;
-    struct particle *tempBodies = NULL;
-
-    read_file_parallel(opts, &bodies, num_procs);
+    BodiesT<D> bodies;
+    ForceEngineT<D> engine;
+    ThreadPool pool(opts->n_threads);
+    int s;
+    RunProfile profile;
+
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        read_bodies_mpi(opts, &bodies, num_procs);
+    }
 
-    dt = opts->timestep;
     int subGrps = opts->n_bodiesParallel / num_procs;
+    std::vector<int> counts, displs;
+    equal_counts(subGrps, num_procs, &counts, &displs);
 
     initializeMPITypes();
     MPI_Barrier(MPI_COMM_WORLD);
     start_time = MPI_Wtime();
 
-    for (s = 0; s < opts->n_steps; s++) {
-        tempBodies = &bodies[rank * subGrps];
+    CheckpointWriterT<D> checkpoint(checkpointPath(opts));
+    for (s = firstIteration(opts); s < endIteration(opts); s++) {
+        int lo = rank * subGrps;
 
-        root = (struct Node *)malloc(sizeof(struct Node));
-        memset((char *)root, 0, sizeof(struct Node));
+        {
+            PhaseTimer timer(&profile, PHASE_BUILD);
+            buildForceTree(opts, &engine, &pool, &bodies, opts->n_particles, s);
+        }
+        profileTree(opts, &profile, &engine.tree);
 
-        initialize_root(root);
+        // Compute forces
+        std::vector<vec_t<D>> forces(subGrps);
+        {
+            PhaseTimer timer(&profile, PHASE_FORCE);
+            computeForces(opts, &engine, &pool, lo, lo + subGrps, forces.data());
+        }
+        profileBodies(&profile, bodies.cold.data(), lo, lo + subGrps);
+        profile.steps++;
 
-        // Insert bodies into the tree
-        for (int i = 0; i < opts->n_particles; ++i) {
-            insertBody(opts, root, &bodies[i]);
+        // Update positions
+        {
+            PhaseTimer timer(&profile, PHASE_UPDATE);
+            pool.parallel_for(subGrps, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                for (int j = lo + begin; j < lo + end; j++) {
+                    BodyColdT<D> *cold = &bodies.cold[j];
+                    if (cold->index == -10) continue;
+                    advanceBody(opts, &bodies.hot[j], cold, s, tree_root(&engine.tree));
+                }
+            });
+        }
+
+        {
+            PhaseTimer timer(&profile, PHASE_COMM);
+            // Rank 0 gathers updated positions from all processes
+            if (rank == 0) {
+                for (int p = 1; p < num_procs; p++) {
+                    MPI_Recv(&bodies.hot[p * subGrps], subGrps, bodyHotType<D>(), p, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                }
+            } else {
+                // Each process sends its updated positions to Rank 0
+                MPI_Send(&bodies.hot[lo], subGrps, bodyHotType<D>(), 0, 0, MPI_COMM_WORLD);
+            }
+
+            // Broadcast updated positions from Rank 0 to all processes
+            MPI_Bcast(bodies.hot.data(), opts->n_bodiesParallel, bodyHotType<D>(), 0, MPI_COMM_WORLD);
+        }
+
+        releaseForceTree(opts, &engine);
+
+        int done = completedStep(opts, s);
+        if (checkpointDue(opts, done)) {
+            PhaseTimer timer(&profile, PHASE_IO);
+            gather_cold(&bodies, counts, displs, rank);
+            if (rank == 0) {
+                checkpoint.write(bodies, opts->n_particles, done);
+            }
+        }
+    }
+
+    stop_time = MPI_Wtime();
+    profile.wall_time = stop_time - start_time;
+
+    if (rank == 0) {
+        printf("%f\n", (stop_time - start_time));
+    }
+    int out_lo = rank * subGrps < opts->n_particles ? rank * subGrps : opts->n_particles;
+    int out_hi = (rank + 1) * subGrps < opts->n_particles ? (rank + 1) * subGrps : opts->n_particles;
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        if (!isSnapshotPath(opts->out_file)) {
+            gather_cold(&bodies, counts, displs, rank);
+        }
+        write_bodies_mpi(opts, rank, bodies, out_lo, out_hi - out_lo);
+    }
+    reportPrecision(opts, &engine, rank);
+    writeProfile(opts, &profile, opts->n_particles, rank, num_procs);
+
+    freeMPITypes();
+    MPI_Finalize();
+
+    return 0;
+}
+
+constexpr int PIPELINE_CHUNKS = 8;    // 管線化模式每步把本地段分成幾塊送出
+
+// 每個 rank 負責連續的一段粒子，數量相差不超過一個，不需要補齊用的虛擬粒子
+static void partition_counts(int n, int num_procs, std::vector<int>* counts, std::vector<int>* displs) {
+    counts->resize(num_procs);
+    displs->resize(num_procs);
+    int offset = 0;
+    for (int r = 0; r < num_procs; r++) {
+        (*counts)[r] = n / num_procs + (r < n % num_procs ? 1 : 0);
+        (*displs)[r] = offset;
+        offset += (*counts)[r];
+    }
+}
+
+template <int D>
+static int runAllgatherv(options_t* opts, int rank, int num_procs) {
+    double start_time, stop_time;
+    RunProfile profile;
+    BodiesT<D> bodies;
+    ForceEngineT<D> engine;
+    ThreadPool pool(opts->n_threads);
+    int s;
+    std::vector<int> counts, displs;
+    std::vector<int> costs, next_counts, next_displs;
+
+    // 不補齊：以單一行程的方式讀入
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        read_bodies_mpi(opts, &bodies, 1);
+    }
+    partition_counts(opts->n_particles, num_procs, &counts, &displs);
+
+    const bool pos_only = opts->exchange == "pos";
+    if (opts->balance) {
+        costs.resize(opts->n_particles);
+    }
+
+    initializeMPITypes();
+    MPI_Barrier(MPI_COMM_WORLD);
+    start_time = MPI_Wtime();
+
+    CheckpointWriterT<D> checkpoint(checkpointPath(opts));
+    for (s = firstIteration(opts); s < endIteration(opts); s++) {
+        int lo = displs[rank];
+        int hi = lo + counts[rank];
+
+        {
+            PhaseTimer timer(&profile, PHASE_BUILD);
+            buildForceTree(opts, &engine, &pool, &bodies, opts->n_particles, s);
         }
+        profileTree(opts, &profile, &engine.tree);
 
         // Compute forces
-        std::vector<std::array<double, 2>> forces(subGrps, std::array<double, 2>{0, 0});
-        for (i = 0; i < subGrps; i++) {
-            struct particle *body = &tempBodies[i];
-            if (body->index == -10) continue;
-            forces[i] = compute_force_v2(opts, root, body);
+        std::vector<vec_t<D>> forces(hi - lo);
+        {
+            PhaseTimer timer(&profile, PHASE_FORCE);
+            computeForces(opts, &engine, &pool, lo, hi, forces.data());
         }
+        profileBodies(&profile, bodies.cold.data(), lo, hi);
+        profile.steps++;
 
         // Update positions
-        for (i = 0; i < subGrps; i++) {
-            struct particle *body = &tempBodies[i];
-            if (body->index == -10) continue;
-            updateParticleState(body, dt, root);
+        {
+            PhaseTimer timer(&profile, PHASE_UPDATE);
+            pool.parallel_for(hi - lo, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                for (int j = lo + begin; j < lo + end; j++) {
+                    BodyColdT<D> *cold = &bodies.cold[j];
+                    advanceBody(opts, &bodies.hot[j], cold, s, tree_root(&engine.tree));
+                }
+            });
+        }
+
+        // 負載平衡：交換各粒子的交互作用次數，預估不平衡過大時依 cost 重新切段
+        bool repartition = false;
+        {
+            PhaseTimer timer(&profile, PHASE_COMM);
+            if (opts->balance) {
+                for (int j = lo; j < hi; j++) {
+                    costs[j] = bodies.cold[j].cost;
+                }
+                MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, costs.data(), counts.data(), displs.data(),
+                               MPI_INT, MPI_COMM_WORLD);
+                if (costImbalance(costs.data(), counts, displs) > REBALANCE_TOLERANCE) {
+                    partitionByCost(costs.data(), opts->n_particles, num_procs, &next_counts, &next_displs);
+                    repartition = next_counts != counts;
+                }
+            }
+
+            // 所有 rank 直接交換各自的一段，不經過 rank 0；pos 模式只送熱資料 (位置與質量)。
+            // 要重新分段時，新的擁有者需要完整狀態，這一步連冷資料一起送
+            MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.hot.data(), counts.data(), displs.data(),
+                           bodyHotType<D>(), MPI_COMM_WORLD);
+            if (!pos_only || repartition) {
+                MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.cold.data(), counts.data(),
+                               displs.data(), bodyColdType<D>(), MPI_COMM_WORLD);
+            }
+        }
+
+        if (repartition) {
+            counts.swap(next_counts);
+            displs.swap(next_displs);
+        }
+
+        releaseForceTree(opts, &engine);
+
+        int done = completedStep(opts, s);
+        if (checkpointDue(opts, done)) {
+            if (pos_only) {
+                gather_cold(&bodies, counts, displs, rank);
+            }
+            if (rank == 0) {
+                PhaseTimer timer(&profile, PHASE_IO);
+                checkpoint.write(bodies, opts->n_particles, done);
+            }
+        }
+    }
+
+    stop_time = MPI_Wtime();
+    profile.wall_time = stop_time - start_time;
+
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        // pos 模式下其他 rank 的速度並未同步，文字輸出前先把冷資料收集到 rank 0；
+        // .bhs 輸出由各 rank 寫自己的一段，不需要收集
+        if (pos_only && !isSnapshotPath(opts->out_file)) {
+            gather_cold(&bodies, counts, displs, rank);
         }
 
-        // Rank 0 gathers updated data from all processes
         if (rank == 0) {
-            for (int p = 1; p < num_procs; p++) {
-                MPI_Recv(&bodies[p * subGrps], subGrps, mpiBody, p, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            printf("%f\n", (stop_time - start_time));
+            TIMING_PRINT(printf("Communication: %f s\n", profile.phase_time[PHASE_COMM]));
+        }
+        write_bodies_mpi(opts, rank, bodies, displs[rank], counts[rank]);
+    }
+    reportImbalance(opts, profile.phase_time[PHASE_FORCE], profile.interactions, rank, num_procs);
+    reportPrecision(opts, &engine, rank);
+    writeProfile(opts, &profile, opts->n_particles, rank, num_procs);
+
+    freeMPITypes();
+    MPI_Finalize();
+
+    return 0;
+}
+
+// 管線化模式：本地段切成 PIPELINE_CHUNKS 塊，每算完一塊就以 MPI_Iallgatherv 送出，
+// 並在計算下一塊的空檔把已到達的塊插入下一步的樹，讓交換延遲藏在力計算與建樹後面。
+// 下一步的位置寫到另一個緩衝區，避免本步還在走訪的樹讀到已更新的粒子。
+template <int D>
+static int runOverlap(options_t* opts, int rank, int num_procs) {
+    double start_time, stop_time;
+    RunProfile profile;
+    BodiesT<D> buffers[2];
+    BodiesT<D> *bodies = &buffers[0];
+    ForceEngineT<D> engine;
+    TreeT<D> next_tree;
+    ThreadPool pool(opts->n_threads);
+    int s;
+    std::vector<int> counts, displs;
+
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        read_bodies_mpi(opts, bodies, 1);
+    }
+    int n = opts->n_particles;
+    BodiesT<D> *next = &buffers[1];
+    *next = *bodies;
+    partition_counts(n, num_procs, &counts, &displs);
+
+    // 第 c 塊在每個 rank 的粒子數與位移；所有 rank 依相同順序發出 PIPELINE_CHUNKS 個集體通訊
+    std::vector<std::vector<int>> chunk_counts(PIPELINE_CHUNKS, std::vector<int>(num_procs));
+    std::vector<std::vector<int>> chunk_displs(PIPELINE_CHUNKS, std::vector<int>(num_procs));
+    for (int r = 0; r < num_procs; r++) {
+        int offset = displs[r];
+        for (int c = 0; c < PIPELINE_CHUNKS; c++) {
+            chunk_counts[c][r] = counts[r] / PIPELINE_CHUNKS + (c < counts[r] % PIPELINE_CHUNKS ? 1 : 0);
+            chunk_displs[c][r] = offset;
+            offset += chunk_counts[c][r];
+        }
+    }
+
+    // 樹每步都由收到的粒子重新建立；Morton 建樹需要全部的鍵，只能等交換完成後再建。
+    // direct 模式不建樹，同樣在交換完成後收集來源陣列；自適應領域要等所有粒子到齊才知道根節點範圍
+    options_t step_opts = *opts;
+    step_opts.refit_every = 0;
+    const bool incremental = opts->tree_type != "morton" && opts->force_type != "direct" && opts->domain == "fixed";
+
+    const bool pos_only = opts->exchange == "pos";
+
+    initializeMPITypes();
+    MPI_Barrier(MPI_COMM_WORLD);
+    start_time = MPI_Wtime();
+
+    // 粒子一律依塊的順序插入 (第 0 塊的各 rank、第 1 塊的各 rank ...)，
+    // 質心的捨入因此與到達順序無關，每次執行 (包括從檢查點繼續) 的結果都相同
+    auto insertChunk = [&](TreeT<D>* tree, int c) {
+        for (int r = 0; r < num_procs; r++) {
+            for (int b = chunk_displs[c][r]; b < chunk_displs[c][r] + chunk_counts[c][r]; b++) {
+                insertBody(&step_opts, tree, b);
             }
+        }
+    };
+
+    CheckpointWriterT<D> checkpoint(checkpointPath(opts));
+    {
+        PhaseTimer timer(&profile, PHASE_BUILD);
+        if (incremental) {
+            initialize_root(&engine.tree, bodies);
+            engine.tree.next.resize(n);
+            for (int c = 0; c < PIPELINE_CHUNKS; c++) {
+                insertChunk(&engine.tree, c);
+            }
+            finalizeTree(&engine.tree);
+            prepareForceTree(&step_opts, &engine);
         } else {
-            // Each process sends its updated data to Rank 0
-            MPI_Send(tempBodies, subGrps, mpiBody, 0, 0, MPI_COMM_WORLD);
+            buildForceTree(&step_opts, &engine, &pool, bodies, n, 0);
+        }
+    }
+    for (s = firstIteration(opts); s < endIteration(opts); s++) {
+        profileTree(opts, &profile, &engine.tree);
+        if (incremental) {
+            initialize_root(&next_tree, next);
+            next_tree.next.resize(n);
         }
 
-        // Broadcast updated bodies from Rank 0 to all processes
-        MPI_Bcast(bodies, opts->n_bodiesParallel, mpiBody, 0, MPI_COMM_WORLD);
+        // 建樹只需要熱資料；冷資料 (pos 模式下不送) 另外發出，換緩衝區前才等
+        std::vector<MPI_Request> requests(PIPELINE_CHUNKS, MPI_REQUEST_NULL);
+        std::vector<MPI_Request> cold_requests(PIPELINE_CHUNKS, MPI_REQUEST_NULL);
+        int inserted = 0;   // 已插入下一步樹的塊數
+        for (int c = 0; c < PIPELINE_CHUNKS; c++) {
+            int lo = chunk_displs[c][rank];
+            int hi = lo + chunk_counts[c][rank];
+
+            std::vector<vec_t<D>> forces(hi - lo);
+            {
+                PhaseTimer timer(&profile, PHASE_FORCE);
+                computeForces(&step_opts, &engine, &pool, lo, hi, forces.data());
+            }
+            profileBodies(&profile, bodies->cold.data(), lo, hi);
+            {
+                PhaseTimer timer(&profile, PHASE_UPDATE);
+                pool.parallel_for(hi - lo, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                    for (int j = lo + begin; j < lo + end; j++) {
+                        BodyHotT<D> *hot = &next->hot[j];
+                        BodyColdT<D> *cold = &next->cold[j];
+                        *hot = bodies->hot[j];
+                        *cold = bodies->cold[j];
+                        advanceBody(opts, hot, cold, s, tree_root(&engine.tree));
+                    }
+                });
+            }
 
-        tearDownTree(root);
+            MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, next->hot.data(), chunk_counts[c].data(),
+                            chunk_displs[c].data(), bodyHotType<D>(), MPI_COMM_WORLD, &requests[c]);
+            if (!pos_only) {
+                MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, next->cold.data(), chunk_counts[c].data(),
+                                chunk_displs[c].data(), bodyColdType<D>(), MPI_COMM_WORLD, &cold_requests[c]);
+            }
+
+            // 已到達的塊先插入下一步的樹，MPI_Test 同時推動通訊進度
+            if (incremental) {
+                int flag = 1;
+                while (inserted <= c && flag) {
+                    MPI_Test(&requests[inserted], &flag, MPI_STATUS_IGNORE);
+                    if (flag) {
+                        PhaseTimer timer(&profile, PHASE_BUILD);
+                        insertChunk(&next_tree, inserted++);
+                    }
+                }
+            }
+        }
+
+        // 等剩下的塊並依序插入；只有這段等待是沒被計算蓋住的通訊時間
+        for (int c = inserted; c < PIPELINE_CHUNKS; c++) {
+            {
+                PhaseTimer timer(&profile, PHASE_COMM);
+                MPI_Wait(&requests[c], MPI_STATUS_IGNORE);
+            }
+            if (incremental) {
+                PhaseTimer timer(&profile, PHASE_BUILD);
+                insertChunk(&next_tree, c);
+            }
+        }
+        {
+            PhaseTimer timer(&profile, PHASE_COMM);
+            MPI_Waitall(PIPELINE_CHUNKS, cold_requests.data(), MPI_STATUSES_IGNORE);
+        }
+        profile.steps++;
+
+        std::swap(bodies, next);
+        {
+            PhaseTimer timer(&profile, PHASE_BUILD);
+            if (incremental) {
+                std::swap(engine.tree, next_tree);
+                finalizeTree(&engine.tree);
+                prepareForceTree(&step_opts, &engine);
+            } else {
+                buildForceTree(&step_opts, &engine, &pool, bodies, n, s + 1);
+            }
+        }
+
+        int done = completedStep(opts, s);
+        if (checkpointDue(opts, done)) {
+            if (pos_only) {
+                gather_cold(bodies, counts, displs, rank);
+            }
+            if (rank == 0) {
+                PhaseTimer timer(&profile, PHASE_IO);
+                checkpoint.write(*bodies, n, done);
+            }
+        }
     }
 
     stop_time = MPI_Wtime();
+    profile.wall_time = stop_time - start_time;
 
-    if (rank == 0) {
-        printf("%f\n", (stop_time - start_time));
-        write_file_parallel(opts, bodies);
-    }
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        if (pos_only && !isSnapshotPath(opts->out_file)) {
+            gather_cold(bodies, counts, displs, rank);
+        }
 
-    if (bodies)
-        free(bodies);
+        if (rank == 0) {
+            printf("%f\n", (stop_time - start_time));
+            TIMING_PRINT(printf("Exposed communication: %f s\n", profile.phase_time[PHASE_COMM]));
+        }
+        write_bodies_mpi(opts, rank, *bodies, displs[rank], counts[rank]);
+    }
+    reportImbalance(opts, profile.phase_time[PHASE_FORCE], profile.interactions, rank, num_procs);
+    reportPrecision(opts, &engine, rank);
+    writeProfile(opts, &profile, opts->n_particles, rank, num_procs);
 
     freeMPITypes();
     MPI_Finalize();
@@ -238,6 +755,23 @@ int parallel_mpi_send_recv(options_t* opts, int rank, int num_procs) {
     return 0;
 }
 
+// 各模式依 --dims 選擇二維或三維的版本
+int parallel_mpi(options_t* opts, int rank, int num_procs) {
+    return opts->dims == 3 ? runAllgather<3>(opts, rank, num_procs) : runAllgather<2>(opts, rank, num_procs);
+}
+
+int parallel_mpi_send_recv(options_t* opts, int rank, int num_procs) {
+    return opts->dims == 3 ? runSendRecv<3>(opts, rank, num_procs) : runSendRecv<2>(opts, rank, num_procs);
+}
+
+int parallel_mpi_allgatherv(options_t* opts, int rank, int num_procs) {
+    return opts->dims == 3 ? runAllgatherv<3>(opts, rank, num_procs) : runAllgatherv<2>(opts, rank, num_procs);
+}
+
+int parallel_mpi_overlap(options_t* opts, int rank, int num_procs) {
+    return opts->dims == 3 ? runOverlap<3>(opts, rank, num_procs) : runOverlap<2>(opts, rank, num_procs);
+}
+
 /*
 int parallel_mpi_send_recv_optimize(options_t* opts, int rank, int num_procs) {
     double dt = opts->timestep;
@@ -2,11 +2,22 @@
 #define BARNES_HUT_MPI_H
 
 #include "argparse.h"  // 假設 options_t 的定義在此檔案中
+#include "bodies.h"
 #include "particle.h"
 #include <mpi.h>
+extern MPI_Datatype mpiBody;
+extern MPI_Datatype mpiBodyHot;
+extern MPI_Datatype mpiBodyCold;
+extern MPI_Datatype mpiBodyHot3;   // 三維 (--dims 3)
+extern MPI_Datatype mpiBodyCold3;
+void initializeMPITypes();
+void freeMPITypes();
+
 // Barnes-Hut MPI 版本主函數
 
 int parallel_mpi(options_t* opts, int rank, int size);
 int parallel_mpi_send_recv(options_t* opts, int rank, int num_procs);
+int parallel_mpi_allgatherv(options_t* opts, int rank, int num_procs);
+int parallel_mpi_overlap(options_t* opts, int rank, int num_procs);
 
 #endif  // BARNES_HUT_MPI_H
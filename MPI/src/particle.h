@@ -2,6 +2,7 @@
 
 struct particle {
     int index;
+    int cost = 0;                 // 上一步力計算的交互作用次數，用於負載平衡
     double x, y;
     double mass;
     double v_x, v_y;
@@ -9,3 +10,22 @@ struct particle {
     //double pos[2];
     //double vel[2];
 };
+
+// --dims 3 的檔案格式 (文字檔每行 index x y z mass v_x v_y v_z，或三維的 .bhs 快照)
+struct particle3 {
+    int index;
+    int cost = 0;
+    double x, y, z;
+    double mass;
+    double v_x, v_y, v_z;
+    double a_x = 0.0, a_y = 0.0, a_z = 0.0;
+};
+
+// 維度泛型的程式以 particle_t<D> 取得 D 維的檔案格式
+template <int D> struct particle_of;
+template <> struct particle_of<2> { typedef particle type; };
+template <> struct particle_of<3> { typedef particle3 type; };
+template <int D> using particle_t = typename particle_of<D>::type;
+// 反過來由檔案格式取得維度
+template <typename P> struct dims_of { static constexpr int value = 2; };
+template <> struct dims_of<particle3> { static constexpr int value = 3; };
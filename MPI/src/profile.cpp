@@ -0,0 +1,120 @@
+#include "profile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+static const char* PHASE_NAMES[N_PHASES] = {"build", "force", "update", "comm", "io"};
+
+template <int D>
+void profileTree(const options_t* opts, RunProfile* profile, const TreeT<D>* tree) {
+    if (opts->profile_file.empty() || tree->n_nodes == 0) return;
+
+    // 子節點的索引一定大於父節點，順序掃描即可由父節點推得深度
+    std::vector<int> depth(tree->n_nodes, 0);
+    int max_depth = 0;
+    for (int32_t n = 1; n < tree->n_nodes; n++) {
+        depth[n] = depth[tree->nodes[n].parent] + 1;
+        max_depth = depth[n] > max_depth ? depth[n] : max_depth;
+    }
+    profile->max_depth = max_depth > profile->max_depth ? max_depth : profile->max_depth;
+    profile->node_sum += tree->n_nodes;
+    profile->max_nodes = tree->n_nodes > profile->max_nodes ? tree->n_nodes : profile->max_nodes;
+    profile->trees++;
+}
+
+template <int D>
+void profileBodies(RunProfile* profile, const BodyColdT<D>* cold, int lo, int hi) {
+    for (int i = lo; i < hi; i++) {
+        if (cold[i].index == -10) continue;     // 補齊用的虛擬粒子
+        profile->interactions += cold[i].cost;
+        profile->max_visits = cold[i].cost > profile->max_visits ? cold[i].cost : profile->max_visits;
+        profile->body_steps++;
+    }
+}
+
+template void profileTree<2>(const options_t*, RunProfile*, const Tree*);
+template void profileTree<3>(const options_t*, RunProfile*, const TreeT<3>*);
+template void profileBodies<2>(RunProfile*, const BodyCold*, int, int);
+template void profileBodies<3>(RunProfile*, const BodyColdT<3>*, int, int);
+
+static bool endsWith(const std::string& s, const char* suffix) {
+    std::string t(suffix);
+    return s.size() >= t.size() && s.compare(s.size() - t.size(), t.size(), t) == 0;
+}
+
+static void writeJson(FILE* f, const options_t* opts, int n_bodies, const std::vector<RunProfile>& all) {
+    fprintf(f, "{\n");
+    fprintf(f, "  \"input\": \"%s\",\n", opts->in_file.c_str());
+    fprintf(f, "  \"mpi_type\": \"%s\",\n", opts->mpi_type.c_str());
+    fprintf(f, "  \"ranks\": %zu,\n", all.size());
+    fprintf(f, "  \"threads\": %d,\n", opts->n_threads);
+    fprintf(f, "  \"bodies\": %d,\n", n_bodies);
+    fprintf(f, "  \"steps\": %d,\n", opts->n_steps);
+    fprintf(f, "  \"dims\": %d,\n", opts->dims);
+    fprintf(f, "  \"threshold\": %g,\n", opts->threshold);
+    fprintf(f, "  \"tree\": \"%s\",\n", opts->tree_type.c_str());
+    fprintf(f, "  \"force\": \"%s\",\n", opts->force_type.c_str());
+    fprintf(f, "  \"leaf_size\": %d,\n", opts->leaf_size);
+    fprintf(f, "  \"integrator\": \"%s\",\n", opts->integrator.c_str());
+    fprintf(f, "  \"quadrupole\": %s,\n", opts->quadrupole ? "true" : "false");
+    fprintf(f, "  \"precision\": \"%s\",\n", opts->precision.c_str());
+    fprintf(f, "  \"fmm_order\": %d,\n", opts->fmm_order);
+    fprintf(f, "  \"per_rank\": [\n");
+    for (size_t r = 0; r < all.size(); r++) {
+        const RunProfile& p = all[r];
+        fprintf(f, "    {\"rank\": %zu, \"wall\": %.6f", r, p.wall_time);
+        for (int k = 0; k < N_PHASES; k++) {
+            fprintf(f, ", \"%s\": %.6f", PHASE_NAMES[k], p.phase_time[k]);
+        }
+        fprintf(f, ", \"steps\": %d, \"body_steps\": %lld, \"interactions\": %lld, \"visits_per_body\": %.3f, "
+                   "\"max_visits\": %d, \"max_depth\": %d, \"mean_nodes\": %.1f, \"max_nodes\": %d}%s\n",
+                p.steps, p.body_steps, p.interactions,
+                p.body_steps > 0 ? (double)p.interactions / p.body_steps : 0.0,
+                p.max_visits, p.max_depth, p.trees > 0 ? (double)p.node_sum / p.trees : 0.0, p.max_nodes,
+                r + 1 < all.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// 每個 rank 一列，執行設定重複在每一列，方便多次執行的結果直接串接
+static void writeCsv(FILE* f, const options_t* opts, int n_bodies, const std::vector<RunProfile>& all) {
+    fprintf(f, "input,mpi_type,ranks,threads,bodies,steps,dims,threshold,tree,force,leaf_size,integrator,quadrupole,precision,fmm_order,rank,wall");
+    for (int k = 0; k < N_PHASES; k++) {
+        fprintf(f, ",%s", PHASE_NAMES[k]);
+    }
+    fprintf(f, ",body_steps,interactions,visits_per_body,max_visits,max_depth,mean_nodes,max_nodes\n");
+    for (size_t r = 0; r < all.size(); r++) {
+        const RunProfile& p = all[r];
+        fprintf(f, "%s,%s,%zu,%d,%d,%d,%d,%g,%s,%s,%d,%s,%d,%s,%d,%zu,%.6f", opts->in_file.c_str(), opts->mpi_type.c_str(),
+                all.size(), opts->n_threads, n_bodies, opts->n_steps, opts->dims, opts->threshold,
+                opts->tree_type.c_str(), opts->force_type.c_str(), opts->leaf_size, opts->integrator.c_str(), (int)opts->quadrupole,
+                opts->precision.c_str(), opts->fmm_order, r, p.wall_time);
+        for (int k = 0; k < N_PHASES; k++) {
+            fprintf(f, ",%.6f", p.phase_time[k]);
+        }
+        fprintf(f, ",%lld,%lld,%.3f,%d,%d,%.1f,%d\n", p.body_steps, p.interactions,
+                p.body_steps > 0 ? (double)p.interactions / p.body_steps : 0.0,
+                p.max_visits, p.max_depth, p.trees > 0 ? (double)p.node_sum / p.trees : 0.0, p.max_nodes);
+    }
+}
+
+void writeProfile(const options_t* opts, const RunProfile* profile, int n_bodies, int rank, int num_procs) {
+    if (opts->profile_file.empty()) return;
+
+    std::vector<RunProfile> all(rank == 0 ? num_procs : 0);
+    MPI_Gather(profile, sizeof(RunProfile), MPI_BYTE, all.data(), sizeof(RunProfile), MPI_BYTE, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    FILE* f = fopen(opts->profile_file.c_str(), "w");
+    if (!f) {
+        std::cerr << "Error: Unable to open profile file " << opts->profile_file << std::endl;
+        return;
+    }
+    if (endsWith(opts->profile_file, ".csv")) {
+        writeCsv(f, opts, n_bodies, all);
+    } else {
+        writeJson(f, opts, n_bodies, all);
+    }
+    fclose(f);
+}
@@ -0,0 +1,46 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <mpi.h>
+#include "argparse.h"
+#include "bodies.h"
+#include "tree.h"
+
+// 每個 rank 各階段的累計時間與計數器，執行結束時以 --profile 指定的 JSON / CSV 檔輸出
+enum ProfilePhase { PHASE_BUILD, PHASE_FORCE, PHASE_UPDATE, PHASE_COMM, PHASE_IO, N_PHASES };
+
+struct RunProfile {
+    double phase_time[N_PHASES] = {};
+    double wall_time = 0.0;         // 時間步迴圈的總時間
+    int steps = 0;
+    long long body_steps = 0;       // 本 rank 計算過力的粒子數總和 (粒子 × 步)
+    long long interactions = 0;     // 交互作用 (被接受的節點與直接相加的粒子) 總數
+    int max_visits = 0;             // 單一粒子單步最多的交互作用次數
+    int max_depth = 0;              // 各步樹深度的最大值
+    long long node_sum = 0;         // 各步節點數總和，平均節點數 = node_sum / trees
+    int max_nodes = 0;
+    int trees = 0;
+};
+
+// 區段計時：建構時開始，解構時把經過的時間加到指定階段
+class PhaseTimer {
+public:
+    PhaseTimer(RunProfile* profile, ProfilePhase phase) : profile(profile), phase(phase), start(MPI_Wtime()) {}
+    ~PhaseTimer() { profile->phase_time[phase] += MPI_Wtime() - start; }
+
+private:
+    RunProfile* profile;
+    ProfilePhase phase;
+    double start;
+};
+
+// 記錄這一步的樹深度與節點數 (只在開啟 --profile 時走訪節點)
+template <int D>
+void profileTree(const options_t* opts, RunProfile* profile, const TreeT<D>* tree);
+// 累加 cold[lo, hi) 這一步的交互作用次數
+template <int D>
+void profileBodies(RunProfile* profile, const BodyColdT<D>* cold, int lo, int hi);
+// 收集所有 rank 的紀錄，由 rank 0 依副檔名寫成 JSON 或 CSV (n_bodies 為總粒子數)；未指定 --profile 時不做事
+void writeProfile(const options_t* opts, const RunProfile* profile, int n_bodies, int rank, int num_procs);
+
+#endif // PROFILE_H
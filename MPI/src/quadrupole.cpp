@@ -0,0 +1,33 @@
+#include "quadrupole.h"
+
+// 子節點的索引一定大於父節點，倒序掃描節點池即是由下而上。
+// 葉節點直接由粒子加總；內部節點以平行軸定理合併子節點：I = Σ (I_c + m_c d_c d_cᵀ)，d_c = com_c - com
+void computeQuadrupoles(Tree* tree) {
+    tree->quad.resize(tree->n_nodes);
+    for (int32_t n = tree->n_nodes - 1; n >= 0; n--) {
+        const Node* node = &tree->nodes[n];
+        std::array<double, 3> q = {{0.0, 0.0, 0.0}};
+        if (node->has_children) {
+            for (int c = 0; c < 4; c++) {
+                const Node* child = &tree->nodes[node->chd[c]];
+                if (child->count == 0) continue;
+                const std::array<double, 3>& cq = tree->quad[node->chd[c]];
+                double dx = child->com[0] - node->com[0];
+                double dy = child->com[1] - node->com[1];
+                q[0] += cq[0] + child->mass * dx * dx;
+                q[1] += cq[1] + child->mass * dx * dy;
+                q[2] += cq[2] + child->mass * dy * dy;
+            }
+        } else {
+            for (int i = 0; i < node->count; i++) {
+                const BodyHot* p = &tree->bodies->hot[tree->order[node->first + i]];
+                double dx = p->x - node->com[0];
+                double dy = p->y - node->com[1];
+                q[0] += p->mass * dx * dx;
+                q[1] += p->mass * dx * dy;
+                q[2] += p->mass * dy * dy;
+            }
+        }
+        tree->quad[n] = q;
+    }
+}
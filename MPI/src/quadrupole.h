@@ -0,0 +1,25 @@
+#ifndef QUADRUPOLE_H
+#define QUADRUPOLE_H
+
+#include "common.h"
+#include "tree.h"
+
+// 四極矩：節點內粒子對節點質心的二階質量矩 I = Σ m (p - com)(p - com)ᵀ，存成 {Ixx, Ixy, Iyy}。
+// 以質心展開時偶極項為 0，位勢 -G Σ m / |x - p| 展開到二階為
+//   -G [M / r + (3 rᵀ I r - tr(I) r²) / (2 r⁵)]，r = x - com，
+// 對 x 取負梯度即為下面的四極修正加速度。
+void computeQuadrupoles(Tree* tree);
+
+// 四極項對 (rx, ry) = 粒子位置 - 節點質心 的加速度修正 (含 G)，d 為兩者距離 (走訪時已算出)
+inline void quadrupoleAccel(double rx, double ry, double d, double qxx, double qxy, double qyy,
+                            double* ax, double* ay) {
+    double inv_r = 1.0 / d;
+    double inv_r2 = inv_r * inv_r;
+    double inv_r5 = inv_r2 * inv_r2 * inv_r;
+    double rIr = qxx * rx * rx + 2.0 * qxy * rx * ry + qyy * ry * ry;
+    double radial = 1.5 * (qxx + qyy) - 7.5 * rIr * inv_r2;
+    *ax += G * inv_r5 * (3.0 * (qxx * rx + qxy * ry) + radial * rx);
+    *ay += G * inv_r5 * (3.0 * (qxy * rx + qyy * ry) + radial * ry);
+}
+
+#endif // QUADRUPOLE_H
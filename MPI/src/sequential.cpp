@@ -9,21 +9,38 @@
 #include <array>
 #include <mpi.h> // For MPI_Wtime()
 #include "io.h"
+#include "thread_pool.h"
+#include "force.h"
+#include "block_step.h"
+#include "checkpoint.h"
+#include "domain.h"
+#include "integrator.h"
+#include "profile.h"
 #include <cstdlib>
 #include <iostream>
+#include <numeric>
 #include <thread> // for std::this_thread::sleep_for
 //#include "visualization.h"
 
-int BHSeq(const options_t* opts) {
-    particle* p = nullptr; // 使用新的 particle 結構體
-    Node* root;
+// 二維與三維共用同一個時間步迴圈
+template <int D>
+static int runSequential(const options_t* opts) {
+    particle_t<D>* p = nullptr; // 讀寫檔案用的 particle 陣列
+    BodiesT<D> bodies;          // 模擬期間的熱 / 冷資料
+    ForceEngineT<D> engine;     // 節點池在各步之間重複使用
+    ThreadPool pool(opts->n_threads);
     int n_p = 0;
+    RunProfile profile;
     
     auto start = std::chrono::high_resolution_clock::now();
 
     // 讀取粒子數據
     //DEBUG_PRINT(std::cout << "Reading particle data from file: " << opts->in_file << std::endl);
-    read_file(opts, &n_p, &p);
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        read_file(opts, &n_p, &p);
+        splitBodies(p, n_p, &bodies);
+    }
     //DEBUG_PRINT(std::cout << "Number of particles: " << n_p << std::endl);
     
     auto start_time = MPI_Wtime();//std::chrono::high_resolution_clock::now();
@@ -33,67 +50,96 @@ int BHSeq(const options_t* opts) {
            update_state_timing = 0.0f,
            free_tree_timing = 0.0f;
 
-    double dt = opts->timestep; // 時間步長
-
-    for (int s = 0; s < opts->n_steps; ++s) {
-        auto iteration_start = std::chrono::high_resolution_clock::now();
-
-        // 初始化根節點
-        root = (Node*)malloc(sizeof(Node));
-        initialize_root(root);
-        // 插入粒子
-        for (int i = 0; i < n_p; ++i) {
-            particle* body = &p[i];
-            insertBody(opts, root, body);
-        }
-        //printTree(root);
-        build_tree_timing += std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
-
-        iteration_start = std::chrono::high_resolution_clock::now();
-
-        // 計算粒子之間的力
-        std::vector<std::array<double, 2>> forces(n_p, {0, 0});
-        for (int i = 0; i < n_p; i++) {
-            particle* body = &p[i];
-            forces[i] = compute_force_v2(opts, root, body);
-        }
-
-        compute_force_timing += std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
-
-        iteration_start = std::chrono::high_resolution_clock::now();
-
-        // 更新粒子位置與速度
-        for (int i = 0; i < n_p; ++i) {
-            particle* body = &p[i];
-            updateParticleState_v2(body,forces[i], dt , root);
+    CheckpointWriterT<D> checkpoint(checkpointPath(opts));
+
+    // 超出邊界的粒子移到陣列尾端，之後只處理前 n_live 個；slot 記錄每個位置對應的輸入順序
+    std::vector<int32_t> slot(n_p);
+    std::iota(slot.begin(), slot.end(), 0);
+    int n_live = compactBodies(&bodies, n_p, &slot);
+
+    // 區塊時間步有自己的子步迴圈，各階段時間直接記在 profile
+    if (opts->block_levels > 0) {
+        runBlockTimesteps(opts, &engine, &pool, &bodies, n_p, &slot, &checkpoint, &profile);
+    } else {
+        for (int s = firstIteration(opts); s < endIteration(opts); ++s) {
+            auto iteration_start = std::chrono::high_resolution_clock::now();
+
+            // 建立四叉樹 (三維為八叉樹)
+            buildForceTree(opts, &engine, &pool, &bodies, n_live, s);
+            profileTree(opts, &profile, &engine.tree);
+            //printTree(&engine.tree);
+            build_tree_timing += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
+
+            iteration_start = std::chrono::high_resolution_clock::now();
+
+            // 計算粒子之間的力
+            std::vector<vec_t<D>> forces(n_live);
+            computeForces(opts, &engine, &pool, 0, n_live, forces.data());
+            profileBodies(&profile, bodies.cold.data(), 0, n_live);
+            profile.steps++;
+
+            compute_force_timing += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
+
+            iteration_start = std::chrono::high_resolution_clock::now();
+
+            // 更新粒子位置與速度
+            pool.parallel_for(n_live, DEFAULT_CHUNK, [&](int begin, int end, int) {
+                for (int i = begin; i < end; ++i) {
+                    BodyHotT<D>* b = &bodies.hot[i];
+                    double a[D];
+                    for (int k = 0; k < D; k++) {
+                        a[k] = forces[i][k] / b->mass;
+                    }
+                    advanceBody(opts, b, &bodies.cold[i], a, s, tree_root(&engine.tree));
+                }
+            });
+
+            update_state_timing += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
+
+            iteration_start = std::chrono::high_resolution_clock::now();
+
+            // 可視化當前狀態
+            /*if (opts->visualization) {
+                visualization_render(n_p, p, &engine.tree, s);
+            }*/
+            // 釋放樹的資源 (只重設節點池)
+            releaseForceTree(opts, &engine);
+
+            // 移走這一步超出邊界的粒子；粒子換了位置，沿用的樹不能再用
+            int live = compactBodies(&bodies, n_live, &slot);
+            if (live != n_live) {
+                n_live = live;
+                tearDownTree(&engine.tree);
+            }
+
+            free_tree_timing += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
+
+            int done = completedStep(opts, s);
+            if (checkpointDue(opts, done)) {
+                PhaseTimer timer(&profile, PHASE_IO);
+                restoreOrder(bodies, n_p, slot, p);
+                checkpoint.write(p, n_p, done);
+            }
         }
-
-        update_state_timing += std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
-
-        iteration_start = std::chrono::high_resolution_clock::now();
-
-        // 可視化當前狀態
-        /*if (opts->visualization) {
-            visualization_render(n_p, p, root,s);
-        }*/
-        // 釋放樹的資源
-        tearDownTree(root);
-
-        free_tree_timing += std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::high_resolution_clock::now() - iteration_start).count() / NS_PER_MS;
     }
 
     auto stop_time = MPI_Wtime();//std::chrono::high_resolution_clock::now();
     //auto diff_loop = stop_time - start_time;//std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time);
     double execution_time_seconds = stop_time - start_time; // 轉換為秒
     printf("%f\n", execution_time_seconds);
+    reportPrecision(opts, &engine, 0);
 
     // 寫入結果到文件
     //DEBUG_PRINT(std::cout << "Writing results to output file: " << opts->out_file << std::endl);
-    write_file(opts, n_p, p);
+    {
+        PhaseTimer timer(&profile, PHASE_IO);
+        restoreOrder(bodies, n_p, slot, p);
+        write_file(opts, n_p, p);
+    }
 
     // 釋放粒子數據
     if (p) free(p);
@@ -101,12 +147,20 @@ int BHSeq(const options_t* opts) {
     // 計算總時間
     auto end = std::chrono::high_resolution_clock::now();
     auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    /*TIMING_PRINT(printf("Build tree: %lf ms\n", build_tree_timing / opts->n_steps));
-    TIMING_PRINT(printf("Compute force: %lf ms\n", compute_force_timing / opts->n_steps));
-    TIMING_PRINT(printf("Update state: %lf ms\n", update_state_timing / opts->n_steps));
-    TIMING_PRINT(printf("Free tree: %lf ms\n", free_tree_timing / opts->n_steps));
-    TIMING_PRINT(printf("Overall per iteration: %lf ms\n", diff.count() / opts->n_steps));
-    TIMING_PRINT(printf("Overall time: %lf ms\n", diff.count()));*/
+    int steps = profile.steps > 0 ? profile.steps : 1;
+    TIMING_PRINT(printf("Build tree: %lf ms\n", build_tree_timing / steps));
+    TIMING_PRINT(printf("Compute force: %lf ms\n", compute_force_timing / steps));
+    TIMING_PRINT(printf("Update state: %lf ms\n", update_state_timing / steps));
+    TIMING_PRINT(printf("Free tree: %lf ms\n", free_tree_timing / steps));
+    TIMING_PRINT(printf("Overall per iteration: %lf ms\n", (double)diff.count() / steps));
+    TIMING_PRINT(printf("Overall time: %lf ms\n", (double)diff.count()));
+
+    // 累計的毫秒換算成秒；釋放樹算在建樹階段
+    profile.wall_time = execution_time_seconds;
+    profile.phase_time[PHASE_BUILD] += (build_tree_timing + free_tree_timing) / MS_PER_S;
+    profile.phase_time[PHASE_FORCE] += compute_force_timing / MS_PER_S;
+    profile.phase_time[PHASE_UPDATE] += update_state_timing / MS_PER_S;
+    writeProfile(opts, &profile, n_p, 0, 1);
     /*if (opts->visualization) {
         terminate_visualization(); // 釋放 OpenGL 資源
     }*/
@@ -114,3 +168,10 @@ int BHSeq(const options_t* opts) {
     MPI_Finalize();
     return 0;
 }
+
+int BHSeq(const options_t* opts) {
+    if (opts->dims == 3) {
+        return runSequential<3>(opts);
+    }
+    return runSequential<2>(opts);
+}
@@ -0,0 +1,248 @@
+#include "snapshot.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t WRITE_BLOCK = 1 << 16;  // 寫檔時每次轉成 SoA 的粒子數
+
+bool isSnapshotPath(const std::string& path) {
+    size_t len = strlen(SNAPSHOT_EXTENSION);
+    return path.size() >= len && path.compare(path.size() - len, len, SNAPSHOT_EXTENSION) == 0;
+}
+
+// 三維快照中各欄位 (依 SnapshotField 的順序) 是第幾個 double 陣列：x y z mass v_x v_y v_z a_x a_y a_z
+static const int FIELD_SLOT_3D[] = {0, 0, 1, 3, 4, 5, 7, 8, 2, 6, 9};
+
+size_t snapshotFieldOffset(const SnapshotHeader* header, SnapshotField field) {
+    size_t n = header->n;
+    size_t index_bytes = (n * sizeof(int32_t) + 7) & ~(size_t)7;
+    if (field == SNAP_INDEX) {
+        return sizeof(SnapshotHeader);
+    }
+    int slot = (header->flags & SNAPSHOT_3D) ? FIELD_SLOT_3D[field] : field - SNAP_X;
+    return sizeof(SnapshotHeader) + index_bytes + (size_t)slot * n * sizeof(double);
+}
+
+size_t snapshotFileSize(const SnapshotHeader* header) {
+    bool three = header->flags & SNAPSHOT_3D;
+    SnapshotField last = (header->flags & SNAPSHOT_ACCEL) ? (three ? SNAP_AZ : SNAP_AY) : (three ? SNAP_VZ : SNAP_VY);
+    return snapshotFieldOffset(header, last) + header->n * sizeof(double);
+}
+
+void initSnapshotHeader(SnapshotHeader* header, uint64_t n, uint64_t step, uint32_t flags) {
+    memset(header, 0, sizeof(SnapshotHeader));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header->version = SNAPSHOT_VERSION;
+    header->flags = flags;
+    header->n = n;
+    header->step = step;
+}
+
+void checkSnapshotHeader(const SnapshotHeader* header, const std::string& path) {
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        std::cerr << "Error: " << path << " is not a particle snapshot" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (header->version != SNAPSHOT_VERSION) {
+        std::cerr << "Error: " << path << " has snapshot version " << header->version
+                  << ", expected " << SNAPSHOT_VERSION << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (header->n == 0 || header->n > (uint64_t)INT32_MAX) {
+        std::cerr << "Invalid number of inputs in input file" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+int snapshotDims(const SnapshotHeader* header) {
+    return (header->flags & SNAPSHOT_3D) ? 3 : 2;
+}
+
+void checkSnapshotDims(const SnapshotHeader* header, int dims, const std::string& path) {
+    if (snapshotDims(header) != dims) {
+        std::cerr << "Error: " << path << " is a " << snapshotDims(header) << "D snapshot; run with --dims "
+                  << snapshotDims(header) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void readSnapshotHeader(const std::string& path, SnapshotHeader* header) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        std::cerr << "Error: Unable to open input file " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (fread(header, sizeof(SnapshotHeader), 1, f) != 1) {
+        std::cerr << "Error: " << path << " is not a particle snapshot" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    checkSnapshotHeader(header, path);
+}
+
+void openSnapshot(const std::string& path, Snapshot* snap) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open input file " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    if ((size_t)st.st_size < sizeof(SnapshotHeader)) {
+        std::cerr << "Error: " << path << " is not a particle snapshot" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    snap->size = st.st_size;
+    snap->map = mmap(nullptr, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap->map == MAP_FAILED) {
+        std::cerr << "Error: Unable to map input file " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(&snap->header, snap->map, sizeof(SnapshotHeader));
+    checkSnapshotHeader(&snap->header, path);
+    if (snapshotFileSize(&snap->header) > snap->size) {
+        std::cerr << "Error: " << path << " is truncated" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    const char* base = (const char*)snap->map;
+    const SnapshotHeader* h = &snap->header;
+    snap->index = (const int32_t*)(base + snapshotFieldOffset(h, SNAP_INDEX));
+    snap->x = (const double*)(base + snapshotFieldOffset(h, SNAP_X));
+    snap->y = (const double*)(base + snapshotFieldOffset(h, SNAP_Y));
+    snap->mass = (const double*)(base + snapshotFieldOffset(h, SNAP_MASS));
+    snap->v_x = (const double*)(base + snapshotFieldOffset(h, SNAP_VX));
+    snap->v_y = (const double*)(base + snapshotFieldOffset(h, SNAP_VY));
+    if (h->flags & SNAPSHOT_ACCEL) {
+        snap->a_x = (const double*)(base + snapshotFieldOffset(h, SNAP_AX));
+        snap->a_y = (const double*)(base + snapshotFieldOffset(h, SNAP_AY));
+    }
+    if (h->flags & SNAPSHOT_3D) {
+        snap->z = (const double*)(base + snapshotFieldOffset(h, SNAP_Z));
+        snap->v_z = (const double*)(base + snapshotFieldOffset(h, SNAP_VZ));
+        if (h->flags & SNAPSHOT_ACCEL) {
+            snap->a_z = (const double*)(base + snapshotFieldOffset(h, SNAP_AZ));
+        }
+    }
+}
+
+void closeSnapshot(Snapshot* snap) {
+    if (snap->map) {
+        munmap(snap->map, snap->size);
+    }
+    snap->map = nullptr;
+}
+
+void copySnapshot(const Snapshot* snap, int first, int count, particle* out) {
+    for (int i = 0; i < count; i++) {
+        int k = first + i;
+        particle* b = &out[i];
+        b->index = snap->index[k];
+        b->cost = 0;
+        b->x = snap->x[k];
+        b->y = snap->y[k];
+        b->mass = snap->mass[k];
+        b->v_x = snap->v_x[k];
+        b->v_y = snap->v_y[k];
+        b->a_x = snap->a_x ? snap->a_x[k] : 0.0;
+        b->a_y = snap->a_y ? snap->a_y[k] : 0.0;
+    }
+}
+
+void copySnapshot(const Snapshot* snap, int first, int count, particle3* out) {
+    for (int i = 0; i < count; i++) {
+        int k = first + i;
+        particle3* b = &out[i];
+        b->index = snap->index[k];
+        b->cost = 0;
+        b->x = snap->x[k];
+        b->y = snap->y[k];
+        b->z = snap->z[k];
+        b->mass = snap->mass[k];
+        b->v_x = snap->v_x[k];
+        b->v_y = snap->v_y[k];
+        b->v_z = snap->v_z[k];
+        b->a_x = snap->a_x ? snap->a_x[k] : 0.0;
+        b->a_y = snap->a_y ? snap->a_y[k] : 0.0;
+        b->a_z = snap->a_z ? snap->a_z[k] : 0.0;
+    }
+}
+
+// 把每個粒子的某個欄位分塊轉成連續陣列寫出；任何一塊沒寫完整 (磁碟已滿等) 就回傳 false
+template <typename T, typename P, typename Get>
+static bool writeField(FILE* f, const P* bodies, int n, Get get) {
+    std::vector<T> block(WRITE_BLOCK);
+    for (int lo = 0; lo < n; lo += (int)WRITE_BLOCK) {
+        int cnt = n - lo < (int)WRITE_BLOCK ? n - lo : (int)WRITE_BLOCK;
+        for (int i = 0; i < cnt; i++) {
+            block[i] = get(bodies[lo + i]);
+        }
+        if (fwrite(block.data(), sizeof(T), cnt, f) != (size_t)cnt) return false;
+    }
+    return true;
+}
+
+// 二維與三維共用：三維的 z 欄位依檔案中的順序穿插在 y、v_y、a_y 之後
+template <typename P>
+static bool writeSnapshotFile(const std::string& path, const P* bodies, int n, uint64_t step, uint32_t flags,
+                              bool sync) {
+    constexpr bool three = dims_of<P>::value == 3;
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    initSnapshotHeader(&header, n, step, three ? flags | SNAPSHOT_3D : flags);
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    ok = ok && writeField<int32_t>(f, bodies, n, [](const P& b) { return (int32_t)b.index; });
+    if (ok && n % 2) {
+        int32_t pad = 0;
+        ok = fwrite(&pad, sizeof(pad), 1, f) == 1;
+    }
+    ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.x; });
+    ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.y; });
+    if constexpr (three) {
+        ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.z; });
+    }
+    ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.mass; });
+    ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.v_x; });
+    ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.v_y; });
+    if constexpr (three) {
+        ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.v_z; });
+    }
+    if (flags & SNAPSHOT_ACCEL) {
+        ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.a_x; });
+        ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.a_y; });
+        if constexpr (three) {
+            ok = ok && writeField<double>(f, bodies, n, [](const P& b) { return b.a_z; });
+        }
+    }
+
+    // 緩衝區的資料要到 fflush / fclose 才真正寫出，兩者都要檢查
+    ok = ok && !ferror(f);
+    if (sync) {
+        ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+bool writeSnapshot(const std::string& path, const particle* bodies, int n, uint64_t step, uint32_t flags,
+                   bool sync) {
+    return writeSnapshotFile(path, bodies, n, step, flags, sync);
+}
+
+bool writeSnapshot(const std::string& path, const particle3* bodies, int n, uint64_t step, uint32_t flags,
+                   bool sync) {
+    return writeSnapshotFile(path, bodies, n, step, flags, sync);
+}
@@ -0,0 +1,78 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "particle.h"
+
+// 二進位快照 (.bhs)：64 位元組的檔頭，後面接各欄位的連續陣列 (SoA)，
+// 依序為 index (int32，補齊到 8 位元組)、x、y、mass、v_x、v_y，
+// 檔頭標記 SNAPSHOT_ACCEL 時再接 a_x、a_y。數值以本機 (little-endian) 格式存放，
+// 讀取時直接 mmap，不需要任何解析。
+// 標記 SNAPSHOT_3D 的三維快照依序為 index、x、y、z、mass、v_x、v_y、v_z (與 a_x、a_y、a_z)。
+constexpr char SNAPSHOT_MAGIC[8] = {'B', 'H', 'S', 'N', 'A', 'P', '\0', '\0'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr uint32_t SNAPSHOT_ACCEL = 1u << 0;   // 含加速度陣列
+constexpr uint32_t SNAPSHOT_3D = 1u << 1;      // 三維 (--dims 3) 的粒子
+constexpr const char* SNAPSHOT_EXTENSION = ".bhs";
+
+// 三維的欄位接在後面，二維快照的位移不變
+enum SnapshotField { SNAP_INDEX, SNAP_X, SNAP_Y, SNAP_MASS, SNAP_VX, SNAP_VY, SNAP_AX, SNAP_AY,
+                     SNAP_Z, SNAP_VZ, SNAP_AZ };
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t n;         // 粒子數
+    uint64_t step;      // 寫出時已完成的步數 (一般輸出為 0)
+    uint8_t reserved[32];
+};
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header must stay 64 bytes");
+
+// 以 mmap 開啟的快照，陣列指標直接指向映射的檔案內容
+struct Snapshot {
+    SnapshotHeader header;
+    void* map = nullptr;
+    size_t size = 0;
+    const int32_t* index = nullptr;
+    const double* x = nullptr;
+    const double* y = nullptr;
+    const double* mass = nullptr;
+    const double* v_x = nullptr;
+    const double* v_y = nullptr;
+    const double* a_x = nullptr;    // 無 SNAPSHOT_ACCEL 時為 nullptr
+    const double* a_y = nullptr;
+    const double* z = nullptr;      // 只有 SNAPSHOT_3D
+    const double* v_z = nullptr;
+    const double* a_z = nullptr;
+};
+
+// 依副檔名判斷是否為二進位快照
+bool isSnapshotPath(const std::string& path);
+// 欄位陣列在檔案中的位元組位移
+size_t snapshotFieldOffset(const SnapshotHeader* header, SnapshotField field);
+size_t snapshotFileSize(const SnapshotHeader* header);
+void initSnapshotHeader(SnapshotHeader* header, uint64_t n, uint64_t step, uint32_t flags);
+// 檢查 magic 與版本，不符時印出錯誤並結束程式
+void checkSnapshotHeader(const SnapshotHeader* header, const std::string& path);
+// 快照的維度 (2 或 3)；與 --dims 不同時印出錯誤並結束程式
+int snapshotDims(const SnapshotHeader* header);
+void checkSnapshotDims(const SnapshotHeader* header, int dims, const std::string& path);
+
+// 只讀取並檢查檔頭
+void readSnapshotHeader(const std::string& path, SnapshotHeader* header);
+void openSnapshot(const std::string& path, Snapshot* snap);
+void closeSnapshot(Snapshot* snap);
+// 把快照中 [first, first + count) 的粒子複製到 out；沒有加速度陣列時加速度設為 0
+void copySnapshot(const Snapshot* snap, int first, int count, particle* out);
+void copySnapshot(const Snapshot* snap, int first, int count, particle3* out);
+// 寫出快照；開檔或任何一次寫入失敗時回傳 false (不結束程式，由呼叫端決定如何處理)。
+// sync 為 true 時關檔前先 fsync，確保回傳 true 時資料已寫到磁碟。particle3 的快照自動標記 SNAPSHOT_3D
+bool writeSnapshot(const std::string& path, const particle* bodies, int n, uint64_t step, uint32_t flags,
+                   bool sync = false);
+bool writeSnapshot(const std::string& path, const particle3* bodies, int n, uint64_t step, uint32_t flags,
+                   bool sync = false);
+
+#endif // SNAPSHOT_H
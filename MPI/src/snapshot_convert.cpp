@@ -0,0 +1,51 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "io.h"
+#include "snapshot.h"
+
+// 讀入 opts->in_file 後原樣寫到 opts->out_file，P 決定二維或三維的格式
+template <typename P>
+static int convert(const options_t* opts) {
+    int n = 0;
+    P* bodies = nullptr;
+    read_file(opts, &n, &bodies);
+    write_file(opts, n, bodies);
+    free(bodies);
+    return n;
+}
+
+// 在文字格式與二進位快照 (.bhs) 之間轉換，方向由兩個檔名的副檔名決定；
+// 第三個參數為維度 (三維文字檔用 3)，省略時 .bhs 輸入取其標頭記錄的維度，其餘為 2：
+//   ./bh_convert input.txt input.bhs
+//   ./bh_convert output.bhs output.txt
+//   ./bh_convert input3.txt input3.bhs 3
+int main(int argc, char** argv) {
+    if (argc != 3 && argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " <input> <output> [2|3]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    int dims = 2;
+    if (argc == 4) {
+        dims = std::atoi(argv[3]);
+    } else if (isSnapshotPath(argv[1])) {
+        SnapshotHeader header;
+        readSnapshotHeader(argv[1], &header);
+        dims = snapshotDims(&header);
+    }
+    if (dims != 2 && dims != 3) {
+        std::cerr << "Error: dimension must be 2 or 3" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    options_t opts;
+    opts.in_file = argv[1];
+    opts.out_file = argv[2];
+    opts.dims = dims;
+
+    int n = dims == 3 ? convert<particle3>(&opts) : convert<particle>(&opts);
+
+    printf("%d bodies: %s -> %s\n", n, argv[1], argv[2]);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int n_threads) : n_threads(n_threads < 1 ? 1 : n_threads), queues(this->n_threads) {
+    for (int t = 1; t < this->n_threads; ++t) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, t);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv_start.notify_all();
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+void ThreadPool::worker_loop(int tid) {
+    int seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv_start.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        run_chunks(tid);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            n_done++;
+        }
+        cv_done.notify_one();
+    }
+}
+
+// 先取自己佇列的工作塊，再依序向其他佇列竊取
+void ThreadPool::run_chunks(int tid) {
+    for (int k = 0; k < n_threads; ++k) {
+        Queue& q = queues[(tid + k) % n_threads];
+        for (;;) {
+            int c = q.next.fetch_add(1, std::memory_order_relaxed);
+            if (c >= q.end) break;
+            int begin = c * job_chunk;
+            int end = begin + job_chunk < job_n ? begin + job_chunk : job_n;
+            (*job)(begin, end, tid);
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int n, int chunk, const std::function<void(int begin, int end, int tid)>& fn) {
+    if (n <= 0) return;
+    if (chunk < 1) chunk = 1;
+    if (n_threads == 1) {
+        fn(0, n, 0);
+        return;
+    }
+
+    // 工作塊平均分到各執行緒的佇列
+    int n_chunks = (n + chunk - 1) / chunk;
+    for (int t = 0; t < n_threads; ++t) {
+        queues[t].next.store((int)((long long)n_chunks * t / n_threads), std::memory_order_relaxed);
+        queues[t].end = (int)((long long)n_chunks * (t + 1) / n_threads);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        job = &fn;
+        job_n = n;
+        job_chunk = chunk;
+        n_done = 0;
+        generation++;
+    }
+    cv_start.notify_all();
+
+    run_chunks(0);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    cv_done.wait(lock, [&] { return n_done == n_threads - 1; });
+    job = nullptr;
+}
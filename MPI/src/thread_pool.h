@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr int DEFAULT_CHUNK = 256;  // 每個工作塊的粒子數
+
+// 固定數量的工作執行緒。parallel_for 把 [0, n) 切成工作塊，
+// 每個執行緒先處理自己的一段，做完後再向其他執行緒竊取剩餘的工作塊。
+// 呼叫端執行緒本身也是 0 號工作者，因此 n_threads == 1 時不會建立任何執行緒。
+class ThreadPool {
+public:
+    explicit ThreadPool(int n_threads);
+    ~ThreadPool();
+
+    int size() const { return n_threads; }
+    void parallel_for(int n, int chunk, const std::function<void(int begin, int end, int tid)>& fn);
+
+private:
+    struct alignas(64) Queue {
+        std::atomic<int> next;  // 下一個待處理的工作塊
+        int end;                // 此佇列的工作塊上限
+    };
+
+    void worker_loop(int tid);
+    void run_chunks(int tid);
+
+    int n_threads;
+    std::vector<std::thread> workers;
+    std::vector<Queue> queues;
+
+    std::mutex mtx;
+    std::condition_variable cv_start, cv_done;
+    int generation = 0;
+    int n_done = 0;
+    bool stopping = false;
+
+    // 目前這一輪 parallel_for 的參數
+    const std::function<void(int, int, int)>* job = nullptr;
+    int job_n = 0, job_chunk = 1;
+};
+
+#endif // THREAD_POOL_H
@@ -5,6 +5,8 @@
 #include <iostream> // 添加打印功能
 #include <array>
 #include "common.h"
+#include "morton.h"
+#include "quadrupole.h"
 
 // 更新粒子狀態
 
@@ -37,79 +39,114 @@ void updateParticleState_v2(particle* body, const std::array<double, 2>& force,
         body->mass = OUT_OF_BOUNDS_MASS;
     }
 }
+// 兩個質點之間的作用力 (原作公式)，重合的質點不計
+template <int D>
+static inline void pair_force(const double* src, double m, const BodyHotT<D>* body, vec_t<D>* f) {
+    double norm[D];
+    for (int k = 0; k < D; k++) {
+        norm[k] = src[k] - body->pos(k);
+    }
+    double d = sqrt(norm2<D>(norm));
+    if (d == 0.0) return;
+    double limited_dist = d >= RLIMIT ? d : RLIMIT;
+    for (int i = 0; i < D; i++) {
+        (*f)[i] += ((G * (m * body->mass)) / (limited_dist * limited_dist)) * (norm[i] / d);
+    }
+}
+
 //原作版本
-std::array<double, 2> compute_force_v2(const options_t* opts, const Node* node, particle* body) {
-    std::array<double, 2> f = {0, 0};
-    double norm[2];
-    const double G = 0.0001;
-
-    // 打印粒子狀態
-    /*std::cout << "Computing force for Particle " << body->index
-              << " (x=" << body->x << ", y=" << body->y
-              << ", mass=" << body->mass << ")" << std::endl;*/
-
-    if (node && node->data && body->mass != -1) {
-        if (node->data->index != body->index) {
-            norm[0] = node->data->x - body->x;
-            norm[1] = node->data->y - body->y;
-            double d = sqrt(norm[0] * norm[0] + norm[1] * norm[1]);
-            double limited_dist = d >= 0.03 ? d : 0.03;
-
-            if (!node->has_children || ((double)node->s / d < opts->threshold)) {
-                for (int i = 0; i < 2; i++) {
-                    f[i] = ((G * (node->data->mass * body->mass)) / (limited_dist * limited_dist)) * (norm[i] / d);
+template <int D>
+static vec_t<D> compute_force_node(const options_t* opts, const TreeT<D>* tree, int32_t n,
+                                                const BodyHotT<D>* body, int32_t self, int* visits) {
+    vec_t<D> f = {};
+    const NodeT<D>* node = &tree->nodes[n];
+
+    if (node->count == 0) {
+        // 空葉節點
+        return f;
+    }
+
+    // 只有一個粒子的葉節點一律直接計算；其他節點先做 MAC 檢查
+    bool single = !node->has_children && node->count == 1;
+    if (!single) {
+        double r[D];
+        for (int k = 0; k < D; k++) {
+            r[k] = node->com[k] - body->pos(k);
+        }
+        double d = sqrt(norm2<D>(r));
+        if (node->s / d < opts->threshold) {
+            pair_force(node->com, node->mass, body, &f);
+            // 四極修正只在距離大於 RLIMIT 時加上，RLIMIT 內的力已被截斷
+            if constexpr (D == 2) {
+                if (!tree->quad.empty() && d >= RLIMIT) {
+                    const std::array<double, 3>& q = tree->quad[n];
+                    double ax = 0.0, ay = 0.0;
+                    quadrupoleAccel(-r[0], -r[1], d, q[0], q[1], q[2], &ax, &ay);
+                    f[0] += ax * body->mass;
+                    f[1] += ay * body->mass;
                 }
-                /*std::cout << "Force on Particle " << body->index
-                          << " from Node: f_x=" << f[0] << ", f_y=" << f[1] << std::endl;*/
-                return f;
             }
-        } else {
-            //std::cout << "Particle " << body->index << " is the same as the node particle, skipping." << std::endl;
-            return {{0, 0}};
-        }
-    } else {
-        if (!node) {
-            //std::cout << "Node is null, skipping." << std::endl;
+            (*visits)++;
+            return f;
         }
-        return {{0, 0}};
     }
 
-    std::array<double, 2> NEf = {0, 0};
-    std::array<double, 2> NWf = {0, 0};
-    std::array<double, 2> SEf = {0, 0};
-    std::array<double, 2> SWf = {0, 0};
+    if (!node->has_children) {
+        // 葉節點內直接加總，略過粒子本身
+        const int32_t* members = &tree->order[node->first];
+        for (int i = 0; i < node->count; i++) {
+            if (members[i] == self) continue;
+            const BodyHotT<D>* q = &tree->bodies->hot[members[i]];
+            double src[D];
+            for (int k = 0; k < D; k++) {
+                src[k] = q->pos(k);
+            }
+            pair_force(src, q->mass, body, &f);
+            (*visits)++;
+        }
+        return f;
+    }
 
     // 遞迴處理子節點
-    if (node->has_children) {
-        if (node->chd[0]) {
-            NEf = compute_force_v2(opts, node->chd[0], body);
-        }
-        if (node->chd[1]) {
-            NWf = compute_force_v2(opts, node->chd[1], body);
-        }
-        if (node->chd[2]) {
-            SEf = compute_force_v2(opts, node->chd[2], body);
-        }
-        if (node->chd[3]) {
-            SWf = compute_force_v2(opts, node->chd[3], body);
+    for (int c = 0; c < NodeT<D>::N_CHILDREN; c++) {
+        vec_t<D> cf = compute_force_node(opts, tree, node->chd[c], body, self, visits);
+        for (int k = 0; k < D; k++) {
+            f[k] += cf[k];
         }
     }
+    return f;
+}
 
-    // 合併所有方向的力
-    for (int i = 0; i < 2; i++) {
-        f[i] = NEf[i] + NWf[i] + SEf[i] + SWf[i];
+template <int D>
+vec_t<D> compute_force_v2(const options_t* opts, const TreeT<D>* tree, int32_t self) {
+    const BodyHotT<D>* body = &tree->bodies->hot[self];
+    if (tree->n_nodes == 0 || body->mass == OUT_OF_BOUNDS_MASS) {
+        return {};
     }
-    // 更新粒子的加速度
-    body->a_x = f[0] / body->mass;
-    body->a_y = f[1] / body->mass;
-    // 打印最終力
-    /*std::cout << "Total force on Particle " << body->index
-              << ": f_x=" << f[0] << ", f_y=" << f[1] << std::endl;*/
+    int visits = 0;
+    vec_t<D> f = compute_force_node(opts, tree, 0, body, self, &visits);
+    BodyColdT<D>* cold = &tree->bodies->cold[self];
+    cold->cost = visits;
 
+    // 更新粒子的加速度
+    for (int k = 0; k < D; k++) {
+        cold->acc(k) = f[k] / body->mass;
+    }
     return f;
 }
 
 // 檢查粒子是否位於節點內
+template <int D>
+bool contains(const NodeT<D>* node, const BodyHotT<D>* p) {
+    for (int k = 0; k < D; k++) {
+        if (!(p->pos(k) >= node->min_bound[k] && p->pos(k) <= node->max_bound[k])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 原作 updateParticleState 使用的 particle 版本
 bool contains(const Node* node, const particle* p) {
     bool result = (p->x >= node->min_bound[0] && p->x <= node->max_bound[0] &&
                    p->y >= node->min_bound[1] && p->y <= node->max_bound[1]);
@@ -117,149 +154,313 @@ bool contains(const Node* node, const particle* p) {
     return result;
 }
 
-// 釋放四叉樹資源
-void tearDownTree(Node* node) {
-    if (node) {
-        for (int i = 0; i < 4; ++i) {
-            if (node->chd[i]) {
-                tearDownTree(node->chd[i]); // 遞歸釋放子節點
-                node->chd[i] = nullptr;
-            }
-        }
-        if (node->has_children && node->data && node->bIdx == -1) {
-            free(node->data); // 如果是虛擬粒子，釋放內存
-        }
-        free(node); // 釋放節點本身
-    }
+// 釋放樹的資源：節點池保留容量，只需 O(1) 歸零
+template <int D>
+void tearDownTree(TreeT<D>* tree) {
+    tree->n_nodes = 0;
 }
 
-// 初始化根節點
-void initialize_root(Node* root) {
-    memset(root, 0, sizeof(Node)); // 初始化節點內存
-    root->min_bound[0] = 0.0;
-    root->min_bound[1] = 0.0;
-    root->max_bound[0] = 4.0;
-    root->max_bound[1] = 4.0;
-    root->s = 4.0; // 根節點的尺寸
-    root->has_children = false; // 標記根節點未被細分
-    root->data = nullptr; // 根節點暫無粒子數據
-    root->parent = NULL;
-    root->bIdx = 0;
+// 從節點池取出 count 個連續節點，容量不足時才擴充
+template <int D>
+int32_t allocNodes(TreeT<D>* tree, int32_t count) {
+    int32_t first = tree->n_nodes;
+    if ((size_t)(first + count) > tree->nodes.size()) {
+        size_t cap = tree->nodes.size() * 2;
+        if (cap < (size_t)(first + count)) cap = first + count;
+        tree->nodes.resize(cap);
+    }
+    tree->n_nodes += count;
+    return first;
 }
 
-Node* createNode(double minX, double minY, double maxX, double maxY, double size, Node* parent) {
-    Node* node = (Node*)malloc(sizeof(Node));
-    node->min_bound[0] = minX;
-    node->min_bound[1] = minY;
-    node->max_bound[0] = maxX;
-    node->max_bound[1] = maxY;
+template <int D>
+static void initNode(NodeT<D>* node, const double* minB, const double* maxB, double size, int32_t parent) {
+    for (int k = 0; k < D; k++) {
+        node->min_bound[k] = minB[k];
+        node->max_bound[k] = maxB[k];
+        node->com[k] = 0.0;
+    }
     node->s = size;
-    node->has_children = false;
-    node->data = nullptr;
+    node->mass = 0.0;
+    for (int i = 0; i < NodeT<D>::N_CHILDREN; i++) {
+        node->chd[i] = NO_NODE;
+    }
     node->parent = parent;
-    for (int i = 0; i < 4; i++) {
-        node->chd[i] = nullptr;
+    node->bIdx = NO_BODY;
+    node->first = 0;
+    node->count = 0;
+    node->has_children = false;
+}
+
+// 初始化根節點
+template <int D>
+void initialize_root(TreeT<D>* tree, BodiesT<D>* bodies) {
+    if (tree->nodes.empty()) {
+        tree->nodes.resize(1024);
+    }
+    tree->n_nodes = 0;
+    tree->bodies = bodies;
+    int32_t root = allocNodes(tree, 1);
+    double maxB[D];
+    for (int k = 0; k < D; k++) {
+        maxB[k] = tree->root_min[k] + tree->root_size;
     }
-    return node;
+    initNode(&tree->nodes[root], tree->root_min, maxB, tree->root_size, NO_NODE);
 }
 
-//自己的改良版
-//DFS方式插入
-void insertBody(const options_t* opts, Node* node, particle* p) {
-    if (!node || !p) return; // 無效節點或粒子，直接返回
+// 依選項建樹，並設定力計算時的粒子走訪順序
+template <int D>
+void buildTree(const options_t* opts, TreeT<D>* tree, BodiesT<D>* bodies, int n) {
+    if constexpr (D == 2) {
+        if (opts->tree_type == "morton") {
+            buildTreeMorton(opts, tree, bodies, n);
+            return;
+        }
+    }
 
-    // 如果節點尚未分裂且無數據，直接插入粒子
-    if (node->data == nullptr && !node->has_children) {
-        node->data = p;
-        node->bIdx = p->index;
-        return;
+    initialize_root(tree, bodies);
+    tree->next.resize(n);
+    for (int i = 0; i < n; ++i) {
+        insertBody(opts, tree, i);
     }
+    finalizeTree(tree);
+}
 
-    // 如果節點尚未分裂，進行分裂
-    if (!node->has_children) {
-        splitNode(node); // 分裂節點（參見下面的 splitNode 函數）
-
-        // 將已有粒子重新插入到正確的子節點
-        particle* temp = node->data;
-        for (int i = 0; i < 4; i++) {
-            if (contains(node->chd[i], temp)) {
-                insertBody(opts, node->chd[i], temp); // 遞迴插入
-                break;
+// 粒子所在的子節點：第 k 軸落在下半邊時設定第 k 個位元。
+// 二維時與原本 contains() 的檢查順序 (東北、西北、東南、西南) 相同
+template <int D>
+static inline int quadrant(const NodeT<D>* node, const BodyHotT<D>* p) {
+    int c = 0;
+    for (int k = 0; k < D; k++) {
+        double mid = node->min_bound[k] + (node->max_bound[k] - node->min_bound[k]) / 2;
+        c |= (p->pos(k) >= mid ? 0 : 1) << k;
+    }
+    return c;
+}
+
+// 把粒子加入節點：更新質心、總質量與粒子數
+template <int D>
+static inline void addToNode(NodeT<D>* node, const BodyHotT<D>* p) {
+    if (node->count == 0) {
+        for (int k = 0; k < D; k++) {
+            node->com[k] = p->pos(k);
+        }
+        node->mass = p->mass;
+    } else {
+        double totalMass = node->mass + p->mass;
+        for (int k = 0; k < D; k++) {
+            node->com[k] = (node->mass * node->com[k] + p->mass * p->pos(k)) / totalMass;
+        }
+        node->mass = totalMass;
+    }
+    node->count++;
+}
+
+// 把粒子串到葉節點的串列上
+template <int D>
+static inline void pushToLeaf(TreeT<D>* tree, NodeT<D>* leaf, int32_t b) {
+    tree->next[b] = leaf->bIdx;
+    leaf->bIdx = b;
+    addToNode(leaf, &tree->bodies->hot[b]);
+}
+
+//自己的改良版
+//迭代方式由上而下插入，沿途更新質心；葉節點滿了 (且未達深度上限) 才分裂
+template <int D>
+void insertBody(const options_t* opts, TreeT<D>* tree, int32_t b) {
+    const BodyHotT<D>* p = &tree->bodies->hot[b];
+    if (p->mass == OUT_OF_BOUNDS_MASS || !contains(&tree->nodes[0], p)) return;
+    if ((size_t)b >= tree->next.size()) {
+        tree->next.resize(b + 1);
+    }
+
+    int32_t n = 0;
+    for (int depth = 0;; depth++) {
+        NodeT<D>* node = &tree->nodes[n];
+
+        if (!node->has_children) {
+            // 葉節點尚有空間，直接放入
+            if (node->count < opts->leaf_size || depth >= MAX_TREE_DEPTH) {
+                pushToLeaf(tree, node, b);
+                return;
+            }
+
+            // 分裂節點並把已有粒子移到子節點
+            int32_t list = node->bIdx;
+            splitNode(tree, n);
+            node = &tree->nodes[n]; // 節點池可能已擴充
+            while (list != NO_BODY) {
+                int32_t following = tree->next[list];
+                pushToLeaf(tree, &tree->nodes[node->chd[quadrant(node, &tree->bodies->hot[list])]], list);
+                list = following;
             }
+            node->bIdx = NO_BODY;
+            node->has_children = true;
         }
 
-        // 創建虛擬粒子，代表節點的質心
-        node->data = (particle*)malloc(sizeof(particle));
-        memset(node->data, 0, sizeof(particle));
-        node->data->x = temp->x; 
-        node->data->y = temp->y;
-        node->data->mass = temp->mass; 
-        node->data->index = -1;
-        node->bIdx = -1;
-        node->has_children = true;
-    }
-
-    // 將當前粒子插入到正確的子節點
-    for (int i = 0; i < 4; i++) {
-        if (contains(node->chd[i], p)) {
-            insertBody(opts, node->chd[i], p); // 遞迴插入
-            break;
+        // 更新節點的質心和總質量
+        addToNode(node, p);
+        n = node->chd[quadrant(node, p)];
+    }
+}
+
+// 深度優先重排 tree->order，讓每個子樹 (包括葉節點) 的粒子都是連續的一段
+template <int D>
+static void finalizeNode(TreeT<D>* tree, int32_t n) {
+    NodeT<D>* node = &tree->nodes[n];
+    node->first = (int32_t)tree->order.size();
+    if (node->has_children) {
+        for (int c = 0; c < NodeT<D>::N_CHILDREN; c++) {
+            finalizeNode(tree, node->chd[c]);
+        }
+    } else {
+        for (int32_t b = node->bIdx; b != NO_BODY; b = tree->next[b]) {
+            tree->order.push_back(b);
         }
     }
+}
 
-    // 更新節點的質心和總質量
-    double totalMass = node->data->mass + p->mass;
-    node->data->x = (node->data->mass * node->data->x + p->mass * p->x) / totalMass;
-    node->data->y = (node->data->mass * node->data->y + p->mass * p->y) / totalMass;
-    node->data->mass = totalMass;
+template <int D>
+void finalizeTree(TreeT<D>* tree) {
+    tree->order.clear();
+    if (tree->n_nodes > 0) {
+        finalizeNode(tree, 0);
+    }
 }
 
-void splitNode(Node* node) {
-    double xmin = node->min_bound[0], ymin = node->min_bound[1];
-    double xmax = node->max_bound[0], ymax = node->max_bound[1];
-    double midX = xmin + (xmax - xmin) / 2;
-    double midY = ymin + (ymax - ymin) / 2;
-
-    for (int i = 0; i < 4; i++) {
-        double minB[2], maxB[2];
-        switch (i) {
-            case 0: minB[0] = midX; minB[1] = midY; maxB[0] = xmax; maxB[1] = ymax; break; // 東北
-            case 1: minB[0] = xmin; minB[1] = midY; maxB[0] = midX; maxB[1] = ymax; break; // 西北
-            case 2: minB[0] = midX; minB[1] = ymin; maxB[0] = xmax; maxB[1] = midY; break; // 東南
-            case 3: minB[0] = xmin; minB[1] = ymin; maxB[0] = midX; maxB[1] = midY; break; // 西南
+// 沿用上一步的樹：只把離開原葉節點的粒子取出重新插入，
+// 再由下而上重算每個節點的質心。子節點的索引一定大於父節點，
+// 所以倒序掃描節點池就是由下而上的順序。
+template <int D>
+void refitTree(const options_t* opts, TreeT<D>* tree) {
+    const BodyHotT<D>* bodies = tree->bodies->hot.data();
+    tree->moved.clear();
+
+    for (int32_t n = 0; n < tree->n_nodes; n++) {
+        NodeT<D>* leaf = &tree->nodes[n];
+        if (leaf->has_children) continue;
+        int32_t* link = &leaf->bIdx;
+        while (*link != NO_BODY) {
+            int32_t b = *link;
+            if (contains(leaf, &bodies[b]) && bodies[b].mass != OUT_OF_BOUNDS_MASS) {
+                link = &tree->next[b];
+            } else {
+                *link = tree->next[b];
+                leaf->count--;
+                tree->moved.push_back(b);
+            }
+        }
+    }
+
+    for (int32_t b : tree->moved) {
+        insertBody(opts, tree, b);
+    }
+
+    for (int32_t n = tree->n_nodes - 1; n >= 0; n--) {
+        NodeT<D>* node = &tree->nodes[n];
+        node->count = 0;
+        node->mass = 0.0;
+        if (node->has_children) {
+            double c_sum[D] = {};
+            for (int c = 0; c < NodeT<D>::N_CHILDREN; c++) {
+                const NodeT<D>* child = &tree->nodes[node->chd[c]];
+                if (child->count == 0) continue;
+                node->count += child->count;
+                node->mass += child->mass;
+                for (int k = 0; k < D; k++) {
+                    c_sum[k] += child->mass * child->com[k];
+                }
+            }
+            if (node->count > 0) {
+                for (int k = 0; k < D; k++) {
+                    node->com[k] = c_sum[k] / node->mass;
+                }
+            }
+        } else {
+            for (int32_t b = node->bIdx; b != NO_BODY; b = tree->next[b]) {
+                addToNode(node, &bodies[b]);
+            }
         }
+    }
 
-        node->chd[i] = (Node*)malloc(sizeof(Node));
-        memset(node->chd[i], 0, sizeof(Node));
-        node->chd[i]->min_bound[0] = minB[0];
-        node->chd[i]->min_bound[1] = minB[1];
-        node->chd[i]->max_bound[0] = maxB[0];
-        node->chd[i]->max_bound[1] = maxB[1];
-        node->chd[i]->has_children = false;
-        node->chd[i]->s = node->s / 2;
-        node->chd[i]->parent = node;
+    finalizeTree(tree);
+}
+
+// 子節點 i 在第 k 軸的範圍：i 的第 k 個位元為 1 時取下半邊 [min, mid]，否則取上半邊 [mid, max]
+template <int D>
+void splitNode(TreeT<D>* tree, int32_t n) {
+    int32_t first = allocNodes(tree, NodeT<D>::N_CHILDREN);
+    NodeT<D>* node = &tree->nodes[n];
+    double mid[D];
+    for (int k = 0; k < D; k++) {
+        mid[k] = node->min_bound[k] + (node->max_bound[k] - node->min_bound[k]) / 2;
+    }
+
+    for (int i = 0; i < NodeT<D>::N_CHILDREN; i++) {
+        double minB[D], maxB[D];
+        for (int k = 0; k < D; k++) {
+            bool lower = (i >> k) & 1;
+            minB[k] = lower ? node->min_bound[k] : mid[k];
+            maxB[k] = lower ? mid[k] : node->max_bound[k];
+        }
+        node->chd[i] = first + i;
+        initNode(&tree->nodes[first + i], minB, maxB, node->s / 2, n);
     }
 }
 
 #include <stdio.h>
 
-void printTree(struct Node *node) {
-    if (node) {
-        // 打印當前節點的信息
-        printf("===================================================\n");
-        printf("s=%lf min=(%le,%le) max=(%le,%le) div=%d\n",
-               node->s, node->min_bound[0], node->min_bound[1],
-               node->max_bound[0], node->max_bound[1], node->has_children);
-        if (node->data) {
-            printf("mass=%le (x,y)=(%le,%le) Idx=%d\n",
-                   node->data->mass, node->data->x,
-                   node->data->y, node->bIdx);
+template <int D>
+static void printNode(const TreeT<D>* tree, int32_t n) {
+    const NodeT<D>* node = &tree->nodes[n];
+    // 打印當前節點的信息
+    printf("===================================================\n");
+    printf("s=%lf min=(", node->s);
+    for (int k = 0; k < D; k++) {
+        printf(k ? ",%le" : "%le", node->min_bound[k]);
+    }
+    printf(") max=(");
+    for (int k = 0; k < D; k++) {
+        printf(k ? ",%le" : "%le", node->max_bound[k]);
+    }
+    printf(") div=%d\n", node->has_children);
+    if (node->count > 0) {
+        printf("mass=%le com=(", node->mass);
+        for (int k = 0; k < D; k++) {
+            printf(k ? ",%le" : "%le", node->com[k]);
         }
-        printf("===================================================\n");
+        printf(") count=%d\n", node->count);
+    }
+    printf("===================================================\n");
 
-        // 遞歸打印所有子節點
-        for (int i = 0; i < 4; i++) {
-            printTree(node->chd[i]);
+    // 遞歸打印所有子節點
+    if (node->has_children) {
+        for (int i = 0; i < NodeT<D>::N_CHILDREN; i++) {
+            printNode(tree, node->chd[i]);
         }
     }
-}
\ No newline at end of file
+}
+
+template <int D>
+void printTree(const TreeT<D>* tree) {
+    if (tree->n_nodes > 0) {
+        printNode(tree, 0);
+    }
+}
+
+// 二維 (四叉樹) 與三維 (八叉樹) 的實體
+#define INSTANTIATE_TREE(D)                                                                           \
+    template void buildTree<D>(const options_t*, TreeT<D>*, BodiesT<D>*, int);                        \
+    template void insertBody<D>(const options_t*, TreeT<D>*, int32_t);                                \
+    template void finalizeTree<D>(TreeT<D>*);                                                         \
+    template void refitTree<D>(const options_t*, TreeT<D>*);                                          \
+    template bool contains<D>(const NodeT<D>*, const BodyHotT<D>*);                                   \
+    template void tearDownTree<D>(TreeT<D>*);                                                         \
+    template void initialize_root<D>(TreeT<D>*, BodiesT<D>*);                                         \
+    template void splitNode<D>(TreeT<D>*, int32_t);                                                   \
+    template int32_t allocNodes<D>(TreeT<D>*, int32_t);                                               \
+    template vec_t<D> compute_force_v2<D>(const options_t*, const TreeT<D>*, int32_t);   \
+    template void printTree<D>(const TreeT<D>*);
+
+INSTANTIATE_TREE(2)
+INSTANTIATE_TREE(3)
@@ -2,31 +2,78 @@
 #define TREE_H
 
 #include <array>
+#include <cstdint>
 #include <vector>
 #include "argparse.h"
+#include "bodies.h"
 #include "particle.h"
 
-struct Node {
-    double min_bound[2], max_bound[2];
+constexpr int32_t NO_NODE = -1;    // 子節點不存在
+constexpr int32_t NO_BODY = -1;    // 節點不含粒子 (空葉或內部節點)
+constexpr int MAX_TREE_DEPTH = 32; // 深度上限，重合粒子到此就不再細分
+
+// D 維的節點：D = 2 為四叉樹 (4 個子節點)，D = 3 為八叉樹 (8 個子節點)。
+// 第 c 個子節點在第 d 軸取下半邊若且唯若 c 的第 d 個位元為 1，
+// 二維時即原本的東北、西北、東南、西南
+template <int D>
+struct NodeT {
+    static constexpr int N_CHILDREN = 1 << D;
+
+    double min_bound[D], max_bound[D];
     double s;           // 節點的大小
+    double com[D];      // 質心 (取代原本 malloc 出來的虛擬粒子)
+    double mass;        // 子樹總質量
+    int32_t chd[N_CHILDREN];    // 子節點在節點池中的索引
+    int32_t parent;     // 父節點索引
+    int32_t bIdx;       // 插入期間葉節點粒子串列的開頭 (串列接在 Tree::next)
+    int32_t first;      // 子樹粒子在 Tree::order 中的起點 (建樹完成後)
+    int32_t count;      // 子樹內的粒子數
     bool has_children;
-    particle* data;        // 指向包含的粒子
-    Node* chd[4];       // 四個子節點
-    Node* parent;       // 父節點
-    int bIdx;           // 粒子的索引
 };
 
+// 連續節點池：整棵樹放在同一塊記憶體裡，節點之間以 32 位元索引連結。
+// 每一步只需把 n_nodes 歸零即可重用，不再逐節點 malloc / free。
+template <int D>
+struct TreeT {
+    std::vector<NodeT<D>> nodes;
+    int32_t n_nodes = 0;            // 目前使用中的節點數
+    BodiesT<D>* bodies = nullptr;   // 建樹所用的粒子 (只讀 hot，力計算結果寫到 cold)
+
+    // 葉節點最多容納 opts->leaf_size 個粒子，插入時以 next 串起同一葉節點的粒子
+    std::vector<int32_t> next;
+
+    // 力計算依此順序走訪粒子，每個葉節點的粒子在其中是連續的一段
+    std::vector<int32_t> order;
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> keys_tmp;     // 基數排序暫存
+    std::vector<int32_t> order_tmp;
+    std::vector<int32_t> moved;         // refit 時離開原葉節點的粒子
+    std::vector<std::array<double, 3>> quad;    // 各節點的四極矩 {Ixx, Ixy, Iyy}，只在二維 --quadrupole 時計算
+
+    // 下一次建樹時根節點的角落 (各軸最小值) 與邊長 (見 setRootBox)；預設為固定領域 [MIN_X, MAX_X]^D
+    double root_min[D] = {};
+    double root_size = 4.0;
+};
+
+// 二維 (原本的四叉樹) 所用的名稱；Morton 建樹、四極矩、FMM 與 MPI 驅動程式只有二維
+using Node = NodeT<2>;
+using Tree = TreeT<2>;
 
-void insertBody(const options_t* opts, Node* node, particle* body);
-void compute_force(const options_t* opts, const Node* node, particle* p);
-//std::array<double, 2> compute_force_correct(const options_t* opts, const Node* node, particle* p);
+template <int D> void buildTree(const options_t* opts, TreeT<D>* tree, BodiesT<D>* bodies, int n);
+template <int D> void insertBody(const options_t* opts, TreeT<D>* tree, int32_t b);
+template <int D> void finalizeTree(TreeT<D>* tree);
+template <int D> void refitTree(const options_t* opts, TreeT<D>* tree);
+template <int D> bool contains(const NodeT<D>* node, const BodyHotT<D>* body);
 bool contains(const Node* node, const particle* body);
-void tearDownTree(Node* node);
-void initialize_root(Node* root);
-//void insertBody_v2(const options_t* opts, Node* node, particle* p);
+template <int D> void tearDownTree(TreeT<D>* tree);
+template <int D> void initialize_root(TreeT<D>* tree, BodiesT<D>* bodies);
 void updateParticleState_v2(particle* b, const std::array<double, 2>& forces, double timestep, const Node* root);
 void updateParticleState(particle* b, double timestep, const Node* root);
-void splitNode(Node* node);
-std::array<double, 2> compute_force_v2(const options_t* opts, const Node* node, particle* b);
-void printTree(struct Node *node);
+template <int D> void splitNode(TreeT<D>* tree, int32_t n);
+template <int D> int32_t allocNodes(TreeT<D>* tree, int32_t count);
+template <int D> vec_t<D> compute_force_v2(const options_t* opts, const TreeT<D>* tree, int32_t b);
+template <int D> void printTree(const TreeT<D>* tree);
+
+template <int D>
+inline const NodeT<D>* tree_root(const TreeT<D>* tree) { return &tree->nodes[0]; }
 #endif
@@ -51,8 +51,9 @@ int init_visualization() {
 }
 
 // 绘制四分树边界
-void drawOctreeBounds2D(const Node* node) {
-    if (node == nullptr) return;
+void drawOctreeBounds2D(const Tree* tree, int32_t n) {
+    if (n == NO_NODE) return;
+    const Node* node = &tree->nodes[n];
 
     glBegin(GL_LINES);
     glColor3f(0.8f, 0.8f, 0.8f); // 灰色线条
@@ -75,7 +76,7 @@ void drawOctreeBounds2D(const Node* node) {
 
     if (node->has_children) {
         for (int i = 0; i < 4; ++i) {
-            drawOctreeBounds2D(node->chd[i]);
+            drawOctreeBounds2D(tree, node->chd[i]);
         }
     }
 }
@@ -88,7 +89,7 @@ void drawOctreeBounds2D(const Node* node) {
 
 
 // 可视化渲染函数
-bool render_visualization(int n_particles, const particle* particles, const Node* root, int step) {
+bool render_visualization(int n_particles, const particle* particles, const Tree* tree, int step) {
     glClear(GL_COLOR_BUFFER_BIT);
 
     // 动态计算 MAX_X 和 MAX_Y
@@ -132,7 +133,9 @@ bool render_visualization(int n_particles, const particle* particles, const Node
     }
 
     // 绘制四分树边界
-    drawOctreeBounds2D(root);
+    if (tree->n_nodes > 0) {
+        drawOctreeBounds2D(tree, 0);
+    }
 
     // 繪製文字，顯示 step
     //char stepText[50];
@@ -4,7 +4,7 @@
 
 // 初始化視覺化窗口
 
-bool render_visualization(int, particle const*, Node const*, int);
+bool render_visualization(int, particle const*, Tree const*, int);
 void terminate_visualization();
 int init_visualization();
 #endif // VISUALIZATION_H